@@ -0,0 +1,114 @@
+#pragma once
+
+#include "ReelTwo.h"
+
+/**
+  * \class AllocationCounter
+  *
+  * \brief Debug-build counter of heap allocations made by the main loop task
+  *
+  * Only active when USE_ALLOCATION_COUNTER is defined and the firmware is linked with
+  * -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc (see the penumbrashadow_debug
+  * environment in platformio.ini). Every allocation made from the Arduino loop task is
+  * counted, so a steady-state loop() can be checked for zero heap activity.
+  *
+  * Call loopBegin() at the top of loop(). Allocations made between two calls are
+  * attributed to the previous iteration.
+*/
+class AllocationCounter
+{
+public:
+    /** \brief Called from the allocation wrappers */
+    static inline void count()
+    {
+        if (sLoopTask != nullptr && xTaskGetCurrentTaskHandle() == sLoopTask)
+            sAllocations++;
+    }
+
+    void loopBegin()
+    {
+        if (sLoopTask == nullptr)
+        {
+            sLoopTask = xTaskGetCurrentTaskHandle();
+            fLastCount = sAllocations;
+            return;
+        }
+        uint32_t count = sAllocations;
+        uint32_t delta = count - fLastCount;
+        fLastCount = count;
+        fLoops++;
+        if (delta != 0)
+        {
+            fLoopsWithAllocations++;
+            fAllocations += delta;
+            fMaxPerLoop = max(fMaxPerLoop, delta);
+        }
+    }
+
+    void reset()
+    {
+        fLastCount = sAllocations;
+        fLoops = 0;
+        fLoopsWithAllocations = 0;
+        fAllocations = 0;
+        fMaxPerLoop = 0;
+    }
+
+    void printStats()
+    {
+        printf("Loops:                %u\n", fLoops);
+        printf("Loops with alloc:     %u\n", fLoopsWithAllocations);
+        printf("Total allocations:    %u\n", fAllocations);
+        printf("Max per loop:         %u\n", fMaxPerLoop);
+    }
+
+    uint32_t loops() const
+    {
+        return fLoops;
+    }
+
+    uint32_t allocations() const
+    {
+        return fAllocations;
+    }
+
+private:
+    uint32_t fLastCount = 0;
+    uint32_t fLoops = 0;
+    uint32_t fLoopsWithAllocations = 0;
+    uint32_t fAllocations = 0;
+    uint32_t fMaxPerLoop = 0;
+
+    static volatile uint32_t sAllocations;
+    static TaskHandle_t sLoopTask;
+};
+
+volatile uint32_t AllocationCounter::sAllocations;
+TaskHandle_t AllocationCounter::sLoopTask;
+
+extern "C"
+{
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t num, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+
+    void* __wrap_malloc(size_t size)
+    {
+        AllocationCounter::count();
+        return __real_malloc(size);
+    }
+
+    void* __wrap_calloc(size_t num, size_t size)
+    {
+        AllocationCounter::count();
+        return __real_calloc(num, size);
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size)
+    {
+        AllocationCounter::count();
+        return __real_realloc(ptr, size);
+    }
+}
+
+AllocationCounter sAllocationCounter;
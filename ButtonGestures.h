@@ -0,0 +1,168 @@
+#pragma once
+
+#include <Arduino.h>
+
+enum ButtonGesture
+{
+    kGestureTap,
+    kGestureHold,
+    kGestureDoubleTap,
+    kGestureCount
+};
+
+#define BUTTON_BIT(button) (1UL << (button))
+
+/**
+  * \class ButtonState
+  *
+  * \brief Edge detection on a controller button bitmask
+  *
+  * update() is called once per loop with the current bitmask. pressed() and released()
+  * then return the buttons that changed state since the previous loop.
+*/
+class ButtonState
+{
+public:
+    void update(uint32_t mask)
+    {
+        fPrevious = fCurrent;
+        fCurrent = mask;
+    }
+
+    uint32_t current() const
+    {
+        return fCurrent;
+    }
+
+    uint32_t pressed() const
+    {
+        return fCurrent & ~fPrevious;
+    }
+
+    uint32_t released() const
+    {
+        return fPrevious & ~fCurrent;
+    }
+
+    bool isDown(uint32_t buttons) const
+    {
+        return (fCurrent & buttons) == buttons;
+    }
+
+    /** \brief True on the loop where all of the specified buttons became held */
+    bool comboPressed(uint32_t buttons) const
+    {
+        return isDown(buttons) && (fPrevious & buttons) != buttons;
+    }
+
+private:
+    uint32_t fCurrent = 0;
+    uint32_t fPrevious = 0;
+};
+
+/**
+  * \class ButtonGestureTracker
+  *
+  * \brief Turns press and release edges of a button combo into tap, hold and double-tap events
+  *
+  * Binding must provide hasAction(ButtonGesture) and trigger(ButtonGesture). A combo with
+  * only a tap action fires on the press edge. If a hold or double-tap action is bound the
+  * tap is deferred until the gesture is known: hold fires once the button has been down
+  * for the hold time, double-tap fires when the same combo is pressed again within the
+  * double-tap time of its release, otherwise tap fires on release or when the double-tap
+  * window closes. Pressing another combo while an undecided one is still down fires the
+  * first combo's tap.
+*/
+template <class Binding>
+class ButtonGestureTracker
+{
+public:
+    void setTiming(uint32_t holdMs, uint32_t doubleTapMs)
+    {
+        fHoldMs = holdMs;
+        fDoubleTapMs = doubleTapMs;
+    }
+
+    /** \brief Press edge of button. binding is the combo resolved at the moment of the press */
+    void press(uint32_t button, Binding* binding, uint32_t now)
+    {
+        // Another combo is still down and undecided. It is resolved as a tap, which is
+        // what it would be if it had been released before this press
+        if (fActive != nullptr && !fConsumed)
+            fire(fActive, kGestureTap);
+        fButton = button;
+        fActive = binding;
+        fPressTime = now;
+        fConsumed = false;
+        if (fPending != nullptr)
+        {
+            Binding* pending = fPending;
+            fPending = nullptr;
+            if (pending == binding)
+            {
+                fire(binding, kGestureDoubleTap);
+                fConsumed = true;
+                return;
+            }
+            fire(pending, kGestureTap);
+        }
+        if (binding != nullptr &&
+            !binding->hasAction(kGestureHold) &&
+            !binding->hasAction(kGestureDoubleTap))
+        {
+            fire(binding, kGestureTap);
+            fConsumed = true;
+        }
+    }
+
+    /** \brief Called every loop to detect release, hold and the end of the double-tap window */
+    void update(const ButtonState& buttons, uint32_t now)
+    {
+        if (fActive != nullptr)
+        {
+            if (!buttons.isDown(fButton))
+            {
+                if (!fConsumed)
+                {
+                    if (fActive->hasAction(kGestureDoubleTap))
+                    {
+                        fPending = fActive;
+                        fReleaseTime = now;
+                    }
+                    else
+                    {
+                        fire(fActive, kGestureTap);
+                    }
+                }
+                fActive = nullptr;
+            }
+            else if (!fConsumed && fActive->hasAction(kGestureHold) && now - fPressTime >= fHoldMs)
+            {
+                fire(fActive, kGestureHold);
+                fConsumed = true;
+            }
+        }
+        if (fPending != nullptr && now - fReleaseTime > fDoubleTapMs)
+        {
+            Binding* pending = fPending;
+            fPending = nullptr;
+            fire(pending, kGestureTap);
+        }
+    }
+
+private:
+    Binding* fActive = nullptr;
+    Binding* fPending = nullptr;
+    uint32_t fButton = 0;
+    uint32_t fPressTime = 0;
+    uint32_t fReleaseTime = 0;
+    uint32_t fHoldMs = 750;
+    uint32_t fDoubleTapMs = 300;
+    bool fConsumed = false;
+
+    void fire(Binding* binding, ButtonGesture gesture)
+    {
+        if (binding != nullptr)
+            binding->trigger(gesture);
+    }
+};
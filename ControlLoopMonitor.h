@@ -0,0 +1,315 @@
+#pragma once
+
+#include "ReelTwo.h"
+
+// Hardware timer used for the motor watchdog
+#ifndef MOTOR_WATCHDOG_TIMER
+#define MOTOR_WATCHDOG_TIMER 3
+#endif
+
+/**
+  * \class ControlLoopMonitor
+  *
+  * \brief Tracks control loop deadline overruns and arms a hardware-timer motor watchdog
+  *
+  * Each pass through loop() calls loopBegin() and then mark() after every stage. A pass
+  * that takes longer than the budget is counted as an overrun and blamed on the slowest
+  * stage of that pass.
+  *
+  * loopBegin() also feeds an ESP32 hardware timer. If the loop does not come back within
+  * the watchdog deadline the timer interrupt wakes a high priority task on the other core
+  * which calls the supplied stop function. The motors are stopped once per stall. The
+  * stop function runs concurrently with the stalled loop task, so anything it shares with
+  * the loop must be locked (the motor port uses MotorPortLock).
+  *
+  * When the loop blocks between passes it calls sleepBegin() first. The blocked time is
+  * not charged to the pass and is reported with the iteration rate and duty cycle of
+  * each mode (active or idle).
+*/
+class ControlLoopMonitor
+{
+public:
+    enum Stage
+    {
+        kMotorTask,
+        kUSB,
+        kFootDrive,
+        kDomeDrive,
+        kTelemetry,
+        kMarcduino,
+        kToggle,
+        kPanels,
+        kSound,
+        kAutoDome,
+        kConsole,
+        kMarcduinoSerial,
+        kStream,
+        kStageCount
+    };
+
+    enum Mode
+    {
+        kActive,
+        kIdle,
+        kModeCount
+    };
+
+    static const char* stageName(unsigned stage)
+    {
+        static const char* sNames[] = {
+            "Motor Task",
+            "USB",
+            "Foot Drive",
+            "Dome Drive",
+            "Telemetry",
+            "Marcduino",
+            "Toggle",
+            "Panels",
+            "Sound",
+            "Auto Dome",
+            "Console",
+            "Marc Serial",
+            "Stream"
+        };
+        return (stage < SizeOfArray(sNames)) ? sNames[stage] : "Unknown";
+    }
+
+    /** \brief Arm the monitor
+      *
+      * \param budgetMs loop pass budget in milliseconds
+      * \param watchdogMs watchdog deadline in milliseconds, 0 disables the watchdog
+      * \param stopMotors called from the watchdog task when the deadline is missed
+      */
+    void begin(uint32_t budgetMs, uint32_t watchdogMs, void (*stopMotors)())
+    {
+        fStopMotors = stopMotors;
+        setBudget(budgetMs);
+        if (fTask == nullptr)
+        {
+            xTaskCreatePinnedToCore(watchdogTask, "motorwdt", 4096, this,
+                configMAX_PRIORITIES - 1, &fTask, 0);
+        }
+        if (fTimer == nullptr)
+        {
+            // 1MHz tick
+            fTimer = timerBegin(MOTOR_WATCHDOG_TIMER, 80, true);
+            timerAttachInterrupt(fTimer, watchdogISR, true);
+        }
+        setWatchdog(watchdogMs);
+    }
+
+    void setBudget(uint32_t budgetMs)
+    {
+        fBudgetUs = budgetMs * 1000;
+    }
+
+    void setWatchdog(uint32_t watchdogMs)
+    {
+        fWatchdogMs = watchdogMs;
+        if (fTimer == nullptr)
+            return;
+        timerAlarmDisable(fTimer);
+        fTripped = false;
+        if (watchdogMs != 0)
+        {
+            timerWrite(fTimer, 0);
+            timerAlarmWrite(fTimer, uint64_t(watchdogMs) * 1000, true);
+            timerAlarmEnable(fTimer);
+        }
+    }
+
+    void setMode(Mode mode)
+    {
+        fMode = mode;
+    }
+
+    Mode mode() const
+    {
+        return fMode;
+    }
+
+    /** \brief The loop is about to block until the next pass */
+    void sleepBegin()
+    {
+        fSleepStart = micros();
+    }
+
+    /** \brief Start of a loop pass. Finishes accounting for the previous pass and feeds the watchdog */
+    void loopBegin()
+    {
+        uint32_t now = micros();
+        if (fTimer != nullptr && fWatchdogMs != 0)
+        {
+            timerWrite(fTimer, 0);
+            fTripped = false;
+        }
+        if (fPassStart != 0)
+        {
+            uint32_t elapsed = now - fPassStart;
+            uint32_t sleep = 0;
+            if (fSleepStart != 0)
+            {
+                sleep = now - fSleepStart;
+                elapsed = fSleepStart - fPassStart;
+            }
+            ModeStats &mode = fModes[fMode];
+            mode.fIterations++;
+            mode.fBusyUs += elapsed;
+            mode.fSleepUs += sleep;
+            fIterations++;
+            fMaxPassUs = max(fMaxPassUs, elapsed);
+            fRecentMaxPassUs = max(fRecentMaxPassUs, elapsed);
+            if (elapsed > fBudgetUs)
+            {
+                fOverruns++;
+                fStages[fSlowestStage].fOverruns++;
+            }
+        }
+        fPassStart = now;
+        fSleepStart = 0;
+        fLastMark = now;
+        fSlowestStage = kMotorTask;
+        fSlowestUs = 0;
+    }
+
+    /** \brief End of a stage. Time since the previous mark is charged to the stage */
+    void mark(Stage stage)
+    {
+        uint32_t now = micros();
+        uint32_t elapsed = now - fLastMark;
+        fLastMark = now;
+        StageStats &stats = fStages[stage];
+        stats.fMaxUs = max(stats.fMaxUs, elapsed);
+        if (elapsed >= fSlowestUs)
+        {
+            fSlowestUs = elapsed;
+            fSlowestStage = stage;
+        }
+    }
+
+    void reset()
+    {
+        fIterations = 0;
+        fOverruns = 0;
+        fMaxPassUs = 0;
+        fWatchdogTrips = 0;
+        for (unsigned i = 0; i < kStageCount; i++)
+        {
+            fStages[i].fOverruns = 0;
+            fStages[i].fMaxUs = 0;
+        }
+        for (unsigned i = 0; i < kModeCount; i++)
+        {
+            fModes[i] = ModeStats();
+        }
+    }
+
+    void printStats()
+    {
+        printf("Iterations:     %u\n", fIterations);
+        printf("Overruns:       %u (budget %ums)\n", fOverruns, fBudgetUs / 1000);
+        printf("Max pass:       %uus\n", fMaxPassUs);
+        printf("Watchdog trips: %u (deadline %ums)\n", fWatchdogTrips, fWatchdogMs);
+        printf("Stage          Overruns    Max(us)\n");
+        for (unsigned i = 0; i < kStageCount; i++)
+        {
+            printf("%-14s %8u %10u\n", stageName(i), fStages[i].fOverruns, fStages[i].fMaxUs);
+        }
+        printf("Mode         Iterations   Rate(Hz)  Duty(%%)\n");
+        for (unsigned i = 0; i < kModeCount; i++)
+        {
+            const ModeStats &mode = fModes[i];
+            uint64_t totalUs = mode.fBusyUs + mode.fSleepUs;
+            unsigned rate = (totalUs != 0) ? unsigned(mode.fIterations * 1000000ULL / totalUs) : 0;
+            unsigned duty = (totalUs != 0) ? unsigned(mode.fBusyUs * 100 / totalUs) : 0;
+            printf("%-8s%s %10u %10u %8u\n", (i == kIdle) ? "Idle" : "Active",
+                (i == fMode) ? "*" : " ", mode.fIterations, rate, duty);
+        }
+    }
+
+    uint32_t iterations() const
+    {
+        return fIterations;
+    }
+
+    uint32_t overruns() const
+    {
+        return fOverruns;
+    }
+
+    uint32_t watchdogTrips() const
+    {
+        return fWatchdogTrips;
+    }
+
+    /** \brief Slowest pass since the previous call */
+    uint32_t takeRecentMaxPassUs()
+    {
+        uint32_t us = fRecentMaxPassUs;
+        fRecentMaxPassUs = 0;
+        return us;
+    }
+
+private:
+    struct StageStats
+    {
+        uint32_t fOverruns = 0;
+        uint32_t fMaxUs = 0;
+    };
+
+    struct ModeStats
+    {
+        uint32_t fIterations = 0;
+        uint64_t fBusyUs = 0;
+        uint64_t fSleepUs = 0;
+    };
+
+    uint32_t fBudgetUs = 0;
+    uint32_t fWatchdogMs = 0;
+    uint32_t fPassStart = 0;
+    uint32_t fLastMark = 0;
+    uint32_t fSleepStart = 0;
+    Mode fMode = kActive;
+    uint32_t fSlowestUs = 0;
+    Stage fSlowestStage = kMotorTask;
+    uint32_t fIterations = 0;
+    uint32_t fOverruns = 0;
+    uint32_t fMaxPassUs = 0;
+    uint32_t fRecentMaxPassUs = 0;
+    volatile uint32_t fWatchdogTrips = 0;
+    volatile bool fTripped = false;
+    StageStats fStages[kStageCount];
+    ModeStats fModes[kModeCount];
+    hw_timer_t* fTimer = nullptr;
+    TaskHandle_t fTask = nullptr;
+    void (*fStopMotors)() = nullptr;
+
+    static void IRAM_ATTR watchdogISR();
+
+    static void watchdogTask(void* arg)
+    {
+        ControlLoopMonitor* self = (ControlLoopMonitor*)arg;
+        for (;;)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            // The loop task is stalled so it is not driving the motors itself. It may still be
+            // part way through a motor packet, which the stop function waits for
+            if (self->fStopMotors != nullptr)
+                self->fStopMotors();
+            self->fWatchdogTrips++;
+        }
+    }
+};
+
+ControlLoopMonitor sLoopMonitor;
+
+void IRAM_ATTR ControlLoopMonitor::watchdogISR()
+{
+    if (sLoopMonitor.fTripped || sLoopMonitor.fTask == nullptr)
+        return;
+    sLoopMonitor.fTripped = true;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(sLoopMonitor.fTask, &woken);
+    if (woken)
+        portYIELD_FROM_ISR();
+}
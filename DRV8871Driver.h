@@ -65,6 +65,16 @@ public:
         timeoutMs = hundredsOfMillis * 100;
     }
     
+    //Signed PWM currently applied to the motor, -255 <= pwm <= 255
+    int16_t getCurrentPWM() const {
+        return currentPWM;
+    }
+
+    //Signed PWM the driver is ramping towards
+    int16_t getRequestedPWM() const {
+        return requestedPWM;
+    }
+
     void task() {
         ulong now = millis();
         if ((requestedPWM != 0) && (now > (lastCommandMs + timeoutMs))) {
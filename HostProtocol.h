@@ -0,0 +1,347 @@
+#pragma once
+
+#include <Arduino.h>
+
+// First byte of every binary frame. Never appears in console text so the text
+// console and the binary protocol can share the same serial port.
+#define HOST_PROTOCOL_SYNC          0xA5
+#define HOST_PROTOCOL_VERSION       2
+// Room for the longest button action (MARCDUINO_ACTION_MAX_LENGTH) in one GET_ACTIONS reply
+#define HOST_PROTOCOL_MAX_PAYLOAD   1088
+// Partial frames are dropped if the rest does not arrive within this many milliseconds
+#define HOST_PROTOCOL_TIMEOUT       250
+
+/**
+  * \class HostProtocol
+  *
+  * \brief Framing for the binary host protocol
+  *
+  * Frame layout (multi-byte values little endian):
+  *
+  *   sync(0xA5) type(1) seq(1) length(2) payload(length) crc16(2)
+  *
+  * The CRC is CRC-16/CCITT-FALSE over type, seq, length and payload. A reply uses the
+  * request type with the top bit set and echoes the request sequence number.
+*/
+class HostProtocol
+{
+public:
+    /** \brief Feed one received byte. Returns true when a complete frame with a valid CRC is available */
+    bool receive(uint8_t ch, uint32_t now)
+    {
+        if (fState != kSync && now - fLastByte > HOST_PROTOCOL_TIMEOUT)
+        {
+            fErrors++;
+            fState = kSync;
+        }
+        fLastByte = now;
+        switch (fState)
+        {
+            case kSync:
+                if (ch == HOST_PROTOCOL_SYNC)
+                {
+                    fCRC = 0xFFFF;
+                    fState = kType;
+                }
+                break;
+            case kType:
+                fType = ch;
+                fCRC = crc16(fCRC, ch);
+                fState = kSeq;
+                break;
+            case kSeq:
+                fSeq = ch;
+                fCRC = crc16(fCRC, ch);
+                fState = kLengthLow;
+                break;
+            case kLengthLow:
+                fLength = ch;
+                fCRC = crc16(fCRC, ch);
+                fState = kLengthHigh;
+                break;
+            case kLengthHigh:
+                fLength |= uint16_t(ch) << 8;
+                fCRC = crc16(fCRC, ch);
+                fPos = 0;
+                if (fLength > HOST_PROTOCOL_MAX_PAYLOAD)
+                {
+                    fErrors++;
+                    fState = kSync;
+                }
+                else
+                {
+                    fState = (fLength != 0) ? kPayload : kCRCLow;
+                }
+                break;
+            case kPayload:
+                fPayload[fPos++] = ch;
+                fCRC = crc16(fCRC, ch);
+                if (fPos == fLength)
+                    fState = kCRCLow;
+                break;
+            case kCRCLow:
+                fReceivedCRC = ch;
+                fState = kCRCHigh;
+                break;
+            case kCRCHigh:
+                fReceivedCRC |= uint16_t(ch) << 8;
+                fState = kSync;
+                if (fReceivedCRC == fCRC)
+                    return true;
+                fErrors++;
+                break;
+        }
+        return false;
+    }
+
+    /** \brief True while in the middle of a frame */
+    bool receiving() const
+    {
+        return fState != kSync;
+    }
+
+    uint8_t type() const
+    {
+        return fType;
+    }
+
+    uint8_t seq() const
+    {
+        return fSeq;
+    }
+
+    uint16_t length() const
+    {
+        return fLength;
+    }
+
+    const uint8_t* payload() const
+    {
+        return fPayload;
+    }
+
+    uint32_t errors() const
+    {
+        return fErrors;
+    }
+
+    static void send(Print& out, uint8_t type, uint8_t seq, const uint8_t* payload, uint16_t length)
+    {
+        uint8_t header[5] = { HOST_PROTOCOL_SYNC, type, seq, uint8_t(length), uint8_t(length >> 8) };
+        uint16_t crc = 0xFFFF;
+        for (unsigned i = 1; i < sizeof(header); i++)
+            crc = crc16(crc, header[i]);
+        for (unsigned i = 0; i < length; i++)
+            crc = crc16(crc, payload[i]);
+        uint8_t trailer[2] = { uint8_t(crc), uint8_t(crc >> 8) };
+        out.write(header, sizeof(header));
+        if (length != 0)
+            out.write(payload, length);
+        out.write(trailer, sizeof(trailer));
+    }
+
+    static uint16_t crc16(uint16_t crc, uint8_t ch)
+    {
+        crc ^= uint16_t(ch) << 8;
+        for (unsigned i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        return crc;
+    }
+
+private:
+    enum State
+    {
+        kSync,
+        kType,
+        kSeq,
+        kLengthLow,
+        kLengthHigh,
+        kPayload,
+        kCRCLow,
+        kCRCHigh
+    };
+
+    State fState = kSync;
+    uint8_t fType = 0;
+    uint8_t fSeq = 0;
+    uint16_t fLength = 0;
+    uint16_t fPos = 0;
+    uint16_t fCRC = 0;
+    uint16_t fReceivedCRC = 0;
+    uint32_t fLastByte = 0;
+    uint32_t fErrors = 0;
+    uint8_t fPayload[HOST_PROTOCOL_MAX_PAYLOAD];
+};
+
+/**
+  * \class HostPayloadWriter
+  *
+  * \brief Appends little endian values to a fixed payload buffer
+*/
+class HostPayloadWriter
+{
+public:
+    HostPayloadWriter(uint8_t* buffer, uint16_t size) :
+        fBuffer(buffer),
+        fSize(size)
+    {
+    }
+
+    bool u8(uint8_t value)
+    {
+        if (fPos + 1 > fSize)
+            return false;
+        fBuffer[fPos++] = value;
+        return true;
+    }
+
+    bool u16(uint16_t value)
+    {
+        return (remaining() >= 2 && u8(value) && u8(value >> 8));
+    }
+
+    bool i32(int32_t value)
+    {
+        return (remaining() >= 4 && u16(uint32_t(value)) && u16(uint32_t(value) >> 16));
+    }
+
+    /** \brief Unsigned LEB128: 7 bits per byte, low bits first, top bit set on all but the last byte */
+    bool varint(uint32_t value)
+    {
+        do
+        {
+            uint8_t ch = value & 0x7F;
+            value >>= 7;
+            if (!u8((value != 0) ? (ch | 0x80) : ch))
+                return false;
+        }
+        while (value != 0);
+        return true;
+    }
+
+    /** \brief Signed value as a zigzag varint so small negative numbers stay short */
+    bool svarint(int32_t value)
+    {
+        return varint((uint32_t(value) << 1) ^ uint32_t(value >> 31));
+    }
+
+    /** \brief String with a varint length prefix */
+    bool str(const char* value)
+    {
+        size_t len = strlen(value);
+        if (remaining() < len + ((len < 0x80) ? 1 : 2))
+            return false;
+        varint(len);
+        memcpy(&fBuffer[fPos], value, len);
+        fPos += len;
+        return true;
+    }
+
+    uint16_t remaining() const
+    {
+        return fSize - fPos;
+    }
+
+    uint16_t length() const
+    {
+        return fPos;
+    }
+
+    uint8_t* data() const
+    {
+        return fBuffer;
+    }
+
+private:
+    uint8_t* fBuffer;
+    uint16_t fSize;
+    uint16_t fPos = 0;
+};
+
+/**
+  * \class HostPayloadReader
+  *
+  * \brief Reads little endian values from a received payload. ok() turns false on underrun
+*/
+class HostPayloadReader
+{
+public:
+    HostPayloadReader(const uint8_t* buffer, uint16_t length) :
+        fBuffer(buffer),
+        fLength(length)
+    {
+    }
+
+    uint8_t u8()
+    {
+        if (fPos + 1 > fLength)
+        {
+            fOK = false;
+            return 0;
+        }
+        return fBuffer[fPos++];
+    }
+
+    uint16_t u16()
+    {
+        uint16_t lo = u8();
+        return lo | (uint16_t(u8()) << 8);
+    }
+
+    int32_t i32()
+    {
+        uint32_t lo = u16();
+        return int32_t(lo | (uint32_t(u16()) << 16));
+    }
+
+    uint32_t varint()
+    {
+        uint32_t value = 0;
+        for (unsigned shift = 0; shift < 35; shift += 7)
+        {
+            uint8_t ch = u8();
+            value |= uint32_t(ch & 0x7F) << shift;
+            if (!(ch & 0x80))
+                return value;
+        }
+        fOK = false;
+        return 0;
+    }
+
+    int32_t svarint()
+    {
+        uint32_t value = varint();
+        return int32_t(value >> 1) ^ -int32_t(value & 1);
+    }
+
+    /** \brief String with a varint length prefix copied into buffer with a terminator */
+    bool str(char* buffer, size_t size)
+    {
+        uint32_t len = varint();
+        if (!fOK || fPos + len > fLength || len >= size)
+        {
+            fOK = false;
+            return false;
+        }
+        memcpy(buffer, &fBuffer[fPos], len);
+        buffer[len] = '\0';
+        fPos += len;
+        return true;
+    }
+
+    bool atEnd() const
+    {
+        return fPos >= fLength;
+    }
+
+    bool ok() const
+    {
+        return fOK;
+    }
+
+private:
+    const uint8_t* fBuffer;
+    uint16_t fLength;
+    uint16_t fPos = 0;
+    bool fOK = true;
+};
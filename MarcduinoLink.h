@@ -0,0 +1,236 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Commands waiting to be sent to one board
+#define MARCDUINO_QUEUE_DEPTH       16
+// Longest command including terminator
+#define MARCDUINO_COMMAND_MAX       104
+// Longest reply line including terminator. Longer lines are truncated
+#define MARCDUINO_REPLY_MAX         64
+// Commands sent but not yet answered
+#define MARCDUINO_IN_FLIGHT         8
+// Milliseconds before an unanswered command is given up on
+#define MARCDUINO_ACK_TIMEOUT       250
+// Consecutive unanswered commands before a board is treated as one that does not reply
+#define MARCDUINO_ACK_MISSES        3
+
+/**
+  * \class MarcduinoLink
+  *
+  * \brief Command queue with reply-based flow control for one Marcduino board
+  *
+  * send() queues a command. task() sends queued commands and matches each reply line
+  * from the board to the oldest unanswered command, which gives the round trip time.
+  *
+  * Commands normally go out back to back. waitReady() queues a pause: nothing after it
+  * is sent until the board has answered everything sent before it. A board that does not
+  * reply (or has stopped replying) holds the queue for the pause's fallback time instead,
+  * which is the fixed delay the sketch used before.
+  *
+  * The transport is supplied by the sketch: transmit() writes one command, replies come
+  * in through receive() one character at a time or through reply() one line at a time.
+*/
+class MarcduinoLink
+{
+public:
+    typedef void (*Transmit)(const char* cmd);
+    typedef void (*ReplyHandler)(const char* name, const char* line);
+
+    MarcduinoLink(const char* name, Transmit transmit) :
+        fName(name),
+        fTransmit(transmit)
+    {
+    }
+
+    const char* name() const
+    {
+        return fName;
+    }
+
+    void setReplyHandler(ReplyHandler handler)
+    {
+        fReplyHandler = handler;
+    }
+
+    /** \brief Queue a command. Returns false if the queue is full or the command too long */
+    bool send(const char* cmd)
+    {
+        return enqueue(cmd, 0);
+    }
+
+    /** \brief Hold later commands until the board has answered, or for fallbackMs if it does not reply */
+    bool waitReady(uint32_t fallbackMs)
+    {
+        return enqueue("", fallbackMs);
+    }
+
+    /** \brief Feed one received character */
+    void receive(char ch, uint32_t now)
+    {
+        if (ch == '\r' || ch == '\n')
+        {
+            if (fLinePos != 0)
+            {
+                fLine[fLinePos] = '\0';
+                fLinePos = 0;
+                reply(fLine, now);
+            }
+        }
+        else if (fLinePos < sizeof(fLine) - 1)
+        {
+            fLine[fLinePos++] = ch;
+        }
+    }
+
+    /** \brief A complete reply line from the board */
+    void reply(const char* line, uint32_t now)
+    {
+        fReplies++;
+        if (fInFlightCount != 0)
+        {
+            uint32_t rtt = now - fInFlight[fInFlightHead];
+            popInFlight();
+            fAcks++;
+            fRTTSum += rtt;
+            fRTTLast = rtt;
+            fRTTMin = (fAcks == 1) ? rtt : min(fRTTMin, rtt);
+            fRTTMax = max(fRTTMax, rtt);
+        }
+        fMisses = 0;
+        fReplying = true;
+        if (fReplyHandler != nullptr)
+            fReplyHandler(fName, line);
+    }
+
+    /** \brief Called every loop. Expires unanswered commands and sends what the board is ready for */
+    void task(uint32_t now)
+    {
+        while (fInFlightCount != 0 && now - fInFlight[fInFlightHead] > MARCDUINO_ACK_TIMEOUT)
+        {
+            popInFlight();
+            expired();
+        }
+        while (fQueueCount != 0)
+        {
+            if (fWaiting)
+            {
+                uint32_t limit = (fReplying) ? max(fWaitMs, uint32_t(MARCDUINO_ACK_TIMEOUT)) : fWaitMs;
+                if (fInFlightCount != 0 && now - fWaitStart < limit)
+                    return;
+                fWaiting = false;
+            }
+            QueuedCommand &next = fQueue[fQueueHead];
+            if (next.fWaitMs != 0)
+            {
+                fWaiting = true;
+                fWaitMs = next.fWaitMs;
+                fWaitStart = now;
+            }
+            else
+            {
+                if (fInFlightCount == MARCDUINO_IN_FLIGHT)
+                {
+                    popInFlight();
+                    expired();
+                }
+                fInFlight[(fInFlightHead + fInFlightCount++) % MARCDUINO_IN_FLIGHT] = now;
+                fTransmit(next.fCommand);
+                fSent++;
+            }
+            fQueueHead = (fQueueHead + 1) % MARCDUINO_QUEUE_DEPTH;
+            fQueueCount--;
+        }
+    }
+
+    bool idle() const
+    {
+        return fQueueCount == 0 && !fWaiting;
+    }
+
+    void resetStats()
+    {
+        fSent = fReplies = fAcks = fTimeouts = fDropped = 0;
+        fRTTSum = fRTTMin = fRTTMax = fRTTLast = 0;
+        fQueueMax = fQueueCount;
+    }
+
+    void printStats()
+    {
+        printf("%s: %s\n", fName, (fReplying) ? "replying" : "not replying");
+        printf("  Sent: %u Replies: %u Acked: %u Timeouts: %u Dropped: %u Max queue: %u\n",
+            fSent, fReplies, fAcks, fTimeouts, fDropped, fQueueMax);
+        if (fAcks != 0)
+        {
+            printf("  RTT ms min: %u avg: %u max: %u last: %u\n",
+                fRTTMin, unsigned(fRTTSum / fAcks), fRTTMax, fRTTLast);
+        }
+    }
+
+private:
+    struct QueuedCommand
+    {
+        char fCommand[MARCDUINO_COMMAND_MAX];
+        uint32_t fWaitMs;
+    };
+
+    const char* fName;
+    Transmit fTransmit;
+    ReplyHandler fReplyHandler = nullptr;
+
+    QueuedCommand fQueue[MARCDUINO_QUEUE_DEPTH];
+    unsigned fQueueHead = 0;
+    unsigned fQueueCount = 0;
+
+    uint32_t fInFlight[MARCDUINO_IN_FLIGHT];
+    unsigned fInFlightHead = 0;
+    unsigned fInFlightCount = 0;
+
+    bool fWaiting = false;
+    uint32_t fWaitMs = 0;
+    uint32_t fWaitStart = 0;
+    bool fReplying = false;
+    unsigned fMisses = 0;
+
+    char fLine[MARCDUINO_REPLY_MAX];
+    unsigned fLinePos = 0;
+
+    uint32_t fSent = 0;
+    uint32_t fReplies = 0;
+    uint32_t fAcks = 0;
+    uint32_t fTimeouts = 0;
+    uint32_t fDropped = 0;
+    uint32_t fQueueMax = 0;
+    uint64_t fRTTSum = 0;
+    uint32_t fRTTMin = 0;
+    uint32_t fRTTMax = 0;
+    uint32_t fRTTLast = 0;
+
+    bool enqueue(const char* cmd, uint32_t waitMs)
+    {
+        size_t len = strlen(cmd);
+        if (fQueueCount == MARCDUINO_QUEUE_DEPTH || len >= MARCDUINO_COMMAND_MAX)
+        {
+            fDropped++;
+            return false;
+        }
+        QueuedCommand &slot = fQueue[(fQueueHead + fQueueCount++) % MARCDUINO_QUEUE_DEPTH];
+        memcpy(slot.fCommand, cmd, len + 1);
+        slot.fWaitMs = waitMs;
+        fQueueMax = max(fQueueMax, uint32_t(fQueueCount));
+        return true;
+    }
+
+    void popInFlight()
+    {
+        fInFlightHead = (fInFlightHead + 1) % MARCDUINO_IN_FLIGHT;
+        fInFlightCount--;
+    }
+
+    void expired()
+    {
+        fTimeouts++;
+        if (++fMisses >= MARCDUINO_ACK_MISSES)
+            fReplying = false;
+    }
+};
@@ -183,6 +183,8 @@ public:
             }
             filenum = (bank - 1) * MP3_MAX_SOUNDS_PER_BANK + sound;
         }
+        fLastSound = filenum;
+        fSoundCount++;
 
         switch (fModule)
         {
@@ -315,6 +317,23 @@ public:
         }
     }
 
+    // File number of the last sound played, 0 if none
+    uint8_t lastSound() const
+    {
+        return fLastSound;
+    }
+
+    // Number of sounds played since startup
+    uint32_t soundCount() const
+    {
+        return fSoundCount;
+    }
+
+    bool randomEnabled() const
+    {
+        return fRandomEnabled;
+    }
+
     inline void startRandom()
     {
         startRandomInSeconds(1);
@@ -587,6 +606,8 @@ private:
     uint32_t fRandomMinDelay = 600;
     uint32_t fRandomMaxDelay = 10000;
     int fStartupSound = -1;
+    uint8_t fLastSound = 0;
+    uint32_t fSoundCount = 0;
     // global variables, current indexes to banks
     uint8_t fBankIndexes[MP3_MAX_BANKS];
     const uint8_t fMaxSounds[MP3_MAX_BANKS] =
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <Arduino.h>
+#include <utility>
+#include "MotorPortLock.h"
+
+/**
+  * \ingroup Motor
+  *
+  * \class MotorDriver
+  *
+  * \brief Compile-time motor driver wrapper
+  *
+  * The sketch talks to every motor through the same surface:
+  *
+  *   drive(power), turn(power), motor(power), stop(), task(),
+  *   setTimeout(hundredsOfMillis), setDeadband(value), setRamping(value)
+  *
+  * A policy class maps that surface onto one driver type with static inline functions,
+  * and MotorDriver<Policy> owns the driver instance. The hardware combination is picked
+  * with typedefs so every call resolves at compile time and is inlined. Supporting a new
+  * driver only needs a new policy class.
+
+*/
+template <class Policy>
+class MotorDriver
+{
+public:
+    typedef typename Policy::Driver Driver;
+
+    template <typename... Args>
+    MotorDriver(Args&&... args) :
+        fDriver(std::forward<Args>(args)...)
+    {
+    }
+
+    /** \brief Mixed mode throttle, -127 <= power <= 127 */
+    inline void drive(int8_t power)
+    {
+        Policy::drive(fDriver, power);
+    }
+
+    /** \brief Mixed mode turn, -127 <= power <= 127 */
+    inline void turn(int8_t power)
+    {
+        Policy::turn(fDriver, power);
+    }
+
+    /** \brief Single motor power, -127 <= power <= 127 */
+    inline void motor(int8_t power)
+    {
+        Policy::motor(fDriver, power);
+    }
+
+    inline void stop()
+    {
+        Policy::stop(fDriver);
+    }
+
+    /** \brief Called every loop. Drivers that ramp or time out in software do their work here */
+    inline void task()
+    {
+        Policy::task(fDriver);
+    }
+
+    inline void setTimeout(int hundredsOfMillis)
+    {
+        Policy::setTimeout(fDriver, hundredsOfMillis);
+    }
+
+    inline void setDeadband(uint8_t value)
+    {
+        Policy::setDeadband(fDriver, value);
+    }
+
+    inline void setRamping(float value)
+    {
+        Policy::setRamping(fDriver, value);
+    }
+
+    inline Driver& driver()
+    {
+        return fDriver;
+    }
+
+private:
+    Driver fDriver;
+};
+
+/**
+  * \brief Policy for the ReelTwo packet serial drivers (SabertoothDriver, CytronSmartDriveDuoDriver)
+  *
+  * The controller handles mixing, ramping and the command timeout itself so task() is empty.
+  * Every call that writes a packet holds a MotorPortLock, so the motor watchdog can stop
+  * the motors from its own task without corrupting a packet the loop is sending.
+*/
+template <class DriverType>
+struct PacketSerialMotorPolicy
+{
+    typedef DriverType Driver;
+
+    static inline void drive(Driver& d, int8_t power)
+    {
+        MotorPortLock lock;
+        d.drive(power);
+    }
+
+    static inline void turn(Driver& d, int8_t power)
+    {
+        MotorPortLock lock;
+        d.turn(power);
+    }
+
+    static inline void motor(Driver& d, int8_t power)
+    {
+        MotorPortLock lock;
+        d.motor(power);
+    }
+
+    static inline void stop(Driver& d)
+    {
+        MotorPortLock lock;
+        d.stop();
+    }
+
+    static inline void task(Driver&)
+    {
+    }
+
+    static inline void setTimeout(Driver& d, int hundredsOfMillis)
+    {
+        MotorPortLock lock;
+        d.setTimeout(hundredsOfMillis);
+    }
+
+    static inline void setDeadband(Driver& d, uint8_t value)
+    {
+        MotorPortLock lock;
+        d.setDeadband(value);
+    }
+
+    static inline void setRamping(Driver& d, float value)
+    {
+        MotorPortLock lock;
+        d.setRamping(uint8_t(value));
+    }
+};
+
+/**
+  * \brief Policy for single channel PWM drivers (DRV8871Driver)
+  *
+  * There is no mixing so drive() maps to motor() and turn() is ignored. The driver
+  * ramps and times out in software, which needs task() every loop. It does not use
+  * MOTOR_SERIAL, so no call takes the MotorPortLock.
+*/
+template <class DriverType>
+struct PWMMotorPolicy
+{
+    typedef DriverType Driver;
+
+    static inline void drive(Driver& d, int8_t power)
+    {
+        d.motor(power);
+    }
+
+    static inline void turn(Driver&, int8_t)
+    {
+    }
+
+    static inline void motor(Driver& d, int8_t power)
+    {
+        d.motor(power);
+    }
+
+    static inline void stop(Driver& d)
+    {
+        d.stop();
+    }
+
+    static inline void task(Driver& d)
+    {
+        d.task();
+    }
+
+    static inline void setTimeout(Driver& d, int hundredsOfMillis)
+    {
+        d.setTimeout(hundredsOfMillis);
+    }
+
+    static inline void setDeadband(Driver& d, uint8_t value)
+    {
+        d.setDeadband(value);
+    }
+
+    static inline void setRamping(Driver& d, float value)
+    {
+        d.setRamping(value);
+    }
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+/**
+  * \class MotorPortLock
+  *
+  * \brief Scoped lock for writes to the motor controller serial port
+  *
+  * The foot and dome controllers share the bit-banged MOTOR_SERIAL port, which is written
+  * from the loop task and from the motor watchdog task on the other core. Every packet
+  * serial motor command (PacketSerialMotorPolicy) and Sabertooth telemetry request holds a
+  * MotorPortLock while it writes, so a watchdog stop goes out between the loop's packets
+  * instead of in the middle of one. The loop task only holds the lock for a single packet
+  * and inherits the watchdog's priority while it does.
+*/
+class MotorPortLock
+{
+public:
+    MotorPortLock()
+    {
+        xSemaphoreTake(mutex(), portMAX_DELAY);
+    }
+
+    ~MotorPortLock()
+    {
+        xSemaphoreGive(mutex());
+    }
+
+private:
+    static SemaphoreHandle_t mutex()
+    {
+        static SemaphoreHandle_t sMutex = xSemaphoreCreateMutex();
+        return sMutex;
+    }
+};
@@ -66,12 +66,15 @@
 #define USE_DEBUG                     // Define to enable debug diagnostic
 #define USE_PREFERENCES
 #define USE_SABERTOOTH_PACKET_SERIAL
+//#define USE_SABERTOOTH_TELEMETRY    // Read battery, current and temperature back from the Sabertooth 2x32 (MOTOR_SERIAL_RX to S2)
 //#define USE_CYTRON_PACKET_SERIAL
 #define USE_PWM_DOME_MOTOR_DRIVER
 //#define USE_MP3_TRIGGER
 //#define USE_DFMINI_PLAYER
 #define USE_HCR_VOCALIZER
 //#define ENABLE_BODY_MD_SERIAL
+//#define USE_RS485_MARCDUINO_BUS     // Dome and body Marcduinos share an RS-485 bus on the MD_SERIAL port (RTS on RS485_RTS_PIN)
+//#define USE_ALLOCATION_COUNTER      // Count heap allocations in loop(). Needs malloc wrap link flags (pio env penumbrashadow_debug)
 
 //For Speed Setting (Normal): set this to whatever speeds works for you. 0-stop, 127-full speed.
 #define DEFAULT_DRIVE_SPEED_NORMAL          70
@@ -113,14 +116,47 @@
 // Marcduino serial communication baud rate. Default 9600
 #define DEFAULT_MARCDUINO_BAUD              9600
 
+// Foot drive is derated when the Sabertooth battery voltage drops below this value. Tenths of a volt, 0 = disabled
+#define DEFAULT_MIN_BATTERY_VOLTAGE         0
+
+// Foot drive is derated when either foot motor draws more than this current. Tenths of an amp, 0 = disabled
+#define DEFAULT_MAX_MOTOR_CURRENT           0
+
+// Percentage of drive and turn speed available while derated
+#define DEFAULT_DERATE_PERCENT              50
+
+// Milliseconds between telemetry requests to the Sabertooth
+#define DEFAULT_TELEMETRY_INTERVAL          100
+
+// Milliseconds a telemetry reading is trusted for derating
+#define TELEMETRY_MAX_AGE                   2000
+
+// Milliseconds a button combo must be held to trigger its hold action
+#define DEFAULT_BUTTON_HOLD_TIME            750
+
+// Milliseconds between release and the second press of a button combo to trigger its double-tap action
+#define DEFAULT_BUTTON_DOUBLE_TAP_TIME      300
+
+// Milliseconds a single pass through loop() may take before it is counted as an overrun
+#define DEFAULT_LOOP_BUDGET                 20
+
+// Milliseconds without a loop() pass before the hardware watchdog stops the motors. 0 = disabled
+#define DEFAULT_MOTOR_WATCHDOG              250
+
+// Seconds without a controller or console traffic before loop() drops to the idle rate. 0 = never idle
+#define DEFAULT_IDLE_TIME                   60
+
+// Milliseconds loop() blocks between passes while idle. Kept well below the motor watchdog
+#define IDLE_LOOP_TICK                      10
+
 #define PS3_CONTROLLER_FOOT_MAC       "XX:XX:XX:XX:XX:XX"  //Set this to your FOOT PS3 controller MAC address
 #define PS3_CONTROLLER_DOME_MAC       "XX:XX:XX:XX:XX:XX"  //Set to a secondary DOME PS3 controller MAC address (Optional)
 
-String PS3ControllerFootMac = PS3_CONTROLLER_FOOT_MAC;
-String PS3ControllerDomeMAC = PS3_CONTROLLER_DOME_MAC;
+char PS3ControllerFootMac[18] = PS3_CONTROLLER_FOOT_MAC;
+char PS3ControllerDomeMAC[18] = PS3_CONTROLLER_DOME_MAC;
 
-String PS3ControllerBackupFootMac = "XX";  //Set to the MAC Address of your BACKUP FOOT controller (Optional)
-String PS3ControllerBackupDomeMAC = "XX";  //Set to the MAC Address of your BACKUP DOME controller (Optional)
+char PS3ControllerBackupFootMac[18] = "XX";  //Set to the MAC Address of your BACKUP FOOT controller (Optional)
+char PS3ControllerBackupDomeMAC[18] = "XX";  //Set to the MAC Address of your BACKUP DOME controller (Optional)
 
 byte drivespeed1 = DEFAULT_DRIVE_SPEED_NORMAL;
 byte drivespeed2 = DEFAULT_DRIVE_SPEED_OVER_THROTTLE;
@@ -138,6 +174,17 @@ bool invertTurnDirection = DEFAULT_INVERT_TURN_DIRECTION;
 byte domeAutoSpeed = DEFAULT_AUTO_DOME_SPEED;
 int time360DomeTurn = DEFAULT_AUTO_DOME_TURN_TIME;
 
+int minBatteryVoltage = DEFAULT_MIN_BATTERY_VOLTAGE;
+int maxMotorCurrent = DEFAULT_MAX_MOTOR_CURRENT;
+int deratePercent = DEFAULT_DERATE_PERCENT;
+
+int buttonHoldTime = DEFAULT_BUTTON_HOLD_TIME;
+int buttonDoubleTapTime = DEFAULT_BUTTON_DOUBLE_TAP_TIME;
+
+int loopBudget = DEFAULT_LOOP_BUDGET;
+int motorWatchdog = DEFAULT_MOTOR_WATCHDOG;
+int idleTime = DEFAULT_IDLE_TIME;
+
 #define SHADOW_DEBUG(...)       //uncomment this for console DEBUG output
 //#define SHADOW_VERBOSE(...)   //uncomment this for console VERBOSE output
 
@@ -167,6 +214,14 @@ int time360DomeTurn = DEFAULT_AUTO_DOME_TURN_TIME;
 #define PREFERENCE_DOME_DOME_TURN_TIME      "smdometurntime"
 #define PREFERENCE_MOTOR_BAUD               "smmotorbaud"
 #define PREFERENCE_MARCDUINO_BAUD           "smmarcbaud"
+#define PREFERENCE_MIN_BATTERY_VOLTAGE      "smminvolt"
+#define PREFERENCE_MAX_MOTOR_CURRENT        "smmaxcurrent"
+#define PREFERENCE_DERATE_PERCENT           "smderate"
+#define PREFERENCE_BUTTON_HOLD_TIME         "smholdtime"
+#define PREFERENCE_BUTTON_DOUBLE_TAP_TIME   "smdtaptime"
+#define PREFERENCE_LOOP_BUDGET              "smloopbudget"
+#define PREFERENCE_MOTOR_WATCHDOG           "smwatchdog"
+#define PREFERENCE_IDLE_TIME                "smidletime"
 Preferences preferences;
 #endif
 
@@ -282,15 +337,39 @@ Preferences preferences;
 bool handleMarcduinoAction(const char* action);
 void sendMarcCommand(const char* cmd);
 void sendBodyMarcCommand(const char* cmd);
+void waitMarcReady(uint32_t fallbackMs);
+
+// Maximum length of a button action string (including terminator), which is what
+// handleMarcduinoAction() can parse. Only whether each action is bound and customized is
+// cached. Custom actions are read from preferences into one shared buffer when they are
+// used, so triggering a button never touches the heap.
+#define MARCDUINO_ACTION_MAX_LENGTH 1024
+
+// Each button combo has a tap action and optional hold and double-tap actions.
+// The gesture actions are addressed by adding a suffix to the trigger name:
+//   btnUP_MD        tap (or press if no other gesture is bound)
+//   btnUP_MD.hold   held for #SMHOLDTIME milliseconds
+//   btnUP_MD.dtap   pressed twice within #SMDTAPTIME milliseconds
+#include "ButtonGestures.h"
 
 class MarcduinoButtonAction
 {
 public:
-    MarcduinoButtonAction(const char* name, const char* default_action) :
+    MarcduinoButtonAction(const char* name, const char* default_action,
+            const char* default_hold = "", const char* default_double = "") :
         fNext(NULL),
-        fName(name),
-        fDefaultAction(default_action)
+        fName(name)
     {
+        fDefaultAction[kGestureTap] = default_action;
+        fDefaultAction[kGestureHold] = default_hold;
+        fDefaultAction[kGestureDoubleTap] = default_double;
+        for (unsigned i = 0; i < kGestureCount; i++)
+        {
+            fLoaded[i] = false;
+            fCustom[i] = false;
+            fOversize[i] = false;
+            fBound[i] = false;
+        }
         if (*head() == NULL)
             *head() = this;
         if (*tail() != NULL)
@@ -298,69 +377,197 @@ public:
         *tail() = this;
     }
 
-    static MarcduinoButtonAction* findAction(String name)
+    static const char* gestureSuffix(ButtonGesture gesture)
     {
-        for (MarcduinoButtonAction* btn = *head(); btn != NULL; btn = btn->fNext)
+        switch (gesture)
         {
-            if (name.equalsIgnoreCase(btn->name()))
-                return btn;
+            case kGestureHold:
+                return ".hold";
+            case kGestureDoubleTap:
+                return ".dtap";
+            default:
+                return "";
         }
-        return nullptr;
     }
 
-    static void listActions()
+    // Find the trigger "name" or "name.hold" / "name.dtap"
+    static MarcduinoButtonAction* findAction(const char* name, ButtonGesture &gesture)
     {
+        size_t len = strlen(name);
+        gesture = kGestureTap;
+        const char* dot = strchr(name, '.');
+        if (dot != nullptr)
+        {
+            if (strcasecmp(dot, gestureSuffix(kGestureHold)) == 0)
+                gesture = kGestureHold;
+            else if (strcasecmp(dot, gestureSuffix(kGestureDoubleTap)) == 0)
+                gesture = kGestureDoubleTap;
+            else
+                return nullptr;
+            len = dot - name;
+        }
         for (MarcduinoButtonAction* btn = *head(); btn != NULL; btn = btn->fNext)
         {
-            printf("%s: %s\n", btn->name().c_str(), btn->action().c_str());
+            if (strncasecmp(name, btn->name(), len) == 0 && btn->name()[len] == '\0')
+                return btn;
         }
+        return nullptr;
+    }
+
+    static MarcduinoButtonAction* first()
+    {
+        return *head();
+    }
+
+    MarcduinoButtonAction* next()
+    {
+        return fNext;
     }
 
-    void reset()
+    static unsigned count()
     {
-        preferences.remove(fName);
+        unsigned count = 0;
+        for (MarcduinoButtonAction* btn = *head(); btn != NULL; btn = btn->fNext)
+            count++;
+        return count;
     }
 
-    void setAction(String newAction)
+    // Read every action's state from preferences up front so the first press of a
+    // button does not have to
+    static void loadActions()
     {
-        if (strlen(fName) > 15)
+        for (MarcduinoButtonAction* btn = *head(); btn != NULL; btn = btn->fNext)
         {
-            String key = fName;
-            key = key.substring(0, 15);
-            preferences.putString(key.c_str(), newAction);
+            for (unsigned i = 0; i < kGestureCount; i++)
+                btn->loadAction(ButtonGesture(i));
         }
-        else
+    }
+
+    static void listActions()
+    {
+        for (MarcduinoButtonAction* btn = *head(); btn != NULL; btn = btn->fNext)
         {
-            preferences.putString(fName, newAction);
+            printf("%s: %s\n", btn->name(), btn->action());
+            for (unsigned i = kGestureHold; i < kGestureCount; i++)
+            {
+                ButtonGesture gesture = ButtonGesture(i);
+                if (btn->hasAction(gesture))
+                    printf("%s%s: %s\n", btn->name(), gestureSuffix(gesture), btn->action(gesture));
+            }
         }
     }
 
-    void trigger()
+    void reset(ButtonGesture gesture = kGestureTap)
+    {
+        char key[16];
+        preferences.remove(preferenceKey(gesture, key));
+        fLoaded[gesture] = false;
+    }
+
+    bool setAction(const char* newAction, ButtonGesture gesture = kGestureTap)
+    {
+        char key[16];
+        if (strlen(newAction) >= MARCDUINO_ACTION_MAX_LENGTH)
+            return false;
+        preferences.putString(preferenceKey(gesture, key), newAction);
+        fLoaded[gesture] = true;
+        fCustom[gesture] = true;
+        fOversize[gesture] = false;
+        fBound[gesture] = (*newAction != '\0');
+        return true;
+    }
+
+    void trigger(ButtonGesture gesture = kGestureTap)
+    {
+        SHADOW_VERBOSE("TRIGGER: %s%s\n", fName, gestureSuffix(gesture));
+        handleMarcduinoAction(action(gesture));
+    }
+
+    bool hasAction(ButtonGesture gesture)
     {
-        SHADOW_VERBOSE("TRIGGER: %s\n", fName);
-        handleMarcduinoAction(action().c_str());
+        if (!fLoaded[gesture])
+            action(gesture);
+        return fBound[gesture];
     }
 
-    String name()
+    const char* name()
     {
         return fName;
     }
 
-    String action()
+    // Custom actions are returned in a shared buffer that is only valid until the next call
+    const char* action(ButtonGesture gesture = kGestureTap)
     {
-        if (strlen(fName) > 15)
-        {
-            String key = fName;
-            key = key.substring(0, 15);
-            return preferences.getString(key.c_str(), fDefaultAction);
-        }
-        return preferences.getString(fName, fDefaultAction);
+        if (!fLoaded[gesture])
+            loadAction(gesture);
+        if (!fCustom[gesture])
+            return fDefaultAction[gesture];
+        readAction(gesture);
+        return sAction;
     }
 
 private:
     MarcduinoButtonAction* fNext;
     const char* fName;
-    const char* fDefaultAction;
+    const char* fDefaultAction[kGestureCount];
+    bool fLoaded[kGestureCount];
+    bool fCustom[kGestureCount];
+    bool fOversize[kGestureCount];
+    bool fBound[kGestureCount];
+
+    static char sAction[MARCDUINO_ACTION_MAX_LENGTH];
+
+    bool readAction(ButtonGesture gesture)
+    {
+        char key[16];
+        preferenceKey(gesture, key);
+        if (!fOversize[gesture])
+            return (preferences.getString(key, sAction, sizeof(sAction)) != 0);
+        // Saved before actions had a length limit. The parser only ever used the
+        // first MARCDUINO_ACTION_MAX_LENGTH-1 characters, so neither do we
+        String value = preferences.getString(key);
+        snprintf(sAction, sizeof(sAction), "%s", value.c_str());
+        return true;
+    }
+
+    void loadAction(ButtonGesture gesture)
+    {
+        fLoaded[gesture] = true;
+        fOversize[gesture] = false;
+        fCustom[gesture] = readAction(gesture);
+        if (!fCustom[gesture])
+        {
+            // Either not customized or too long for the buffer
+            char key[16];
+            size_t len = preferences.getString(preferenceKey(gesture, key)).length();
+            if (len != 0)
+            {
+                printf("Trigger: %s%s action is %u characters, only the first %d are used\n",
+                    fName, gestureSuffix(gesture), unsigned(len), MARCDUINO_ACTION_MAX_LENGTH-1);
+                fOversize[gesture] = true;
+                fCustom[gesture] = readAction(gesture);
+            }
+        }
+        fBound[gesture] = (*action(gesture) != '\0');
+    }
+
+    // Preference keys are limited to 15 characters. The tap action uses the
+    // (truncated) trigger name, gesture actions use a hash of the name.
+    const char* preferenceKey(ButtonGesture gesture, char key[16])
+    {
+        if (gesture == kGestureTap)
+        {
+            snprintf(key, 16, "%s", fName);
+        }
+        else
+        {
+            uint32_t hash = 2166136261UL;
+            for (const char* ch = fName; *ch != '\0'; ch++)
+                hash = (hash ^ uint8_t(*ch)) * 16777619UL;
+            snprintf(key, 16, "%c%08x", (gesture == kGestureHold) ? 'h' : 'd', unsigned(hash));
+        }
+        return key;
+    }
 
     static MarcduinoButtonAction** head()
     {
@@ -375,6 +582,8 @@ private:
     }
 };
 
+char MarcduinoButtonAction::sAction[MARCDUINO_ACTION_MAX_LENGTH];
+
 #define MARCDUINO_ACTION(var,act) \
 MarcduinoButtonAction var(#var,act);
 
@@ -441,6 +650,9 @@ int marcDuinoBaudRate = DEFAULT_MARCDUINO_BAUD;
 #define FOOT_MOTOR_ADDR      128      // Serial Address for Foot Motor
 #define DOME_MOTOR_ADDR      129      // Serial Address for Dome Motor
 
+#define DOME_MARCDUINO_ADDR  1        // RS-485 bus address for the dome Marcduino
+#define BODY_MARCDUINO_ADDR  2        // RS-485 bus address for the body Marcduino
+
 #define ENABLE_UHS_DEBUGGING 1
 
 // ---------------------------------------------------------------------------------------
@@ -466,10 +678,40 @@ int marcDuinoBaudRate = DEFAULT_MARCDUINO_BAUD;
 #include <motor/CytronSmartDriveDuoDriver.h>
 #endif
 
+#if defined(USE_SABERTOOTH_PACKET_SERIAL) && defined(USE_SABERTOOTH_TELEMETRY)
+#include "SabertoothTelemetry.h"
+#else
+#undef USE_SABERTOOTH_TELEMETRY
+#endif
+
 #ifdef USE_PWM_DOME_MOTOR_DRIVER
 #include <DRV8871Driver.h>
 #endif
 
+#include "MotorDriverPolicy.h"
+
+#ifdef USE_ALLOCATION_COUNTER
+#include "AllocationCounter.h"
+#endif
+
+#include "ControlLoopMonitor.h"
+#include "HostProtocol.h"
+#include "TelemetryStream.h"
+
+#ifdef USE_RS485_MARCDUINO_BUS
+#include "RS485Bus.h"
+#endif
+
+#include "MarcduinoLink.h"
+
+#ifdef USE_RS485_MARCDUINO_BUS
+static_assert(RS485_MAX_PAYLOAD >= MARCDUINO_COMMAND_MAX, "RS485_MAX_PAYLOAD too small for Marcduino commands");
+#endif
+
+#if defined(USE_RS485_MARCDUINO_BUS) || defined(ENABLE_BODY_MD_SERIAL)
+#define USE_BODY_MARCDUINO
+#endif
+
 #include "pin-map.h"
 
 #define CONSOLE_BUFFER_SIZE     300
@@ -497,38 +739,59 @@ PanelStatus sPanelStatus[PANEL_COUNT];
 
 long previousDomeMillis = millis();
 long previousFootMillis = millis();
-long previousMarcDuinoMillis = millis();
 long previousDomeToggleMillis = millis();
-long previousSpeedToggleMillis = millis();
 long currentMillis = millis();
 
 int serialLatency = 25;   //This is a delay factor in ms to prevent queueing of the Serial data.
                           //25ms seems approprate for HardwareSerial, values of 50ms or larger are needed for Softare Emulation
                           
-int marcDuinoButtonCounter = 0;
-int speedToggleButtonCounter = 0;
 int domeToggleButtonCounter = 0;
 
-#ifdef USE_SABERTOOTH_PACKET_SERIAL
-SabertoothDriver FootMotorImpl(FOOT_MOTOR_ADDR, MOTOR_SERIAL);
-SabertoothDriver* FootMotor=&FootMotorImpl;
-    #ifndef USE_PWM_DOME_MOTOR_DRIVER
-SabertoothDriver DomeMotorImpl(DOME_MOTOR_ADDR, MOTOR_SERIAL);
-SabertoothDriver* DomeMotor=&DomeMotorImpl;
-    #endif
+// Controller button bitmasks sampled once per loop (see readButtons)
+ButtonState sFootButtons;
+ButtonState sDomeButtons;
+
+// Motor driver selection. One foot and one dome policy is picked at compile time,
+// see MotorDriverPolicy.h to add another driver.
+#if defined(USE_CYTRON_PACKET_SERIAL)
+typedef MotorDriver<PacketSerialMotorPolicy<CytronSmartDriveDuoMDDS30Driver> > FootMotorDriver;
+#define FOOT_MOTOR_ARGS     FOOT_MOTOR_ADDR, MOTOR_SERIAL
+#elif defined(USE_SABERTOOTH_PACKET_SERIAL)
+typedef MotorDriver<PacketSerialMotorPolicy<SabertoothDriver> > FootMotorDriver;
+#define FOOT_MOTOR_ARGS     FOOT_MOTOR_ADDR, MOTOR_SERIAL
+#else
+#error "Define USE_SABERTOOTH_PACKET_SERIAL or USE_CYTRON_PACKET_SERIAL"
 #endif
 
-#ifdef USE_CYTRON_PACKET_SERIAL
-CytronSmartDriveDuoMDDS30Driver FootMotorImpl(FOOT_MOTOR_ADDR, MOTOR_SERIAL);
-CytronSmartDriveDuoMDDS10Driver DomeMotorImpl(DOME_MOTOR_ADDR, MOTOR_SERIAL);
+#if defined(USE_PWM_DOME_MOTOR_DRIVER)
+typedef MotorDriver<PWMMotorPolicy<DRV8871Driver> > DomeMotorDriver;
+#define DOME_MOTOR_ARGS     DOUT1_PIN, DOUT2_PIN
+#elif defined(USE_CYTRON_PACKET_SERIAL)
+typedef MotorDriver<PacketSerialMotorPolicy<CytronSmartDriveDuoMDDS10Driver> > DomeMotorDriver;
+#define DOME_MOTOR_ARGS     DOME_MOTOR_ADDR, MOTOR_SERIAL
+#else
+typedef MotorDriver<PacketSerialMotorPolicy<SabertoothDriver> > DomeMotorDriver;
+#define DOME_MOTOR_ARGS     DOME_MOTOR_ADDR, MOTOR_SERIAL
+#endif
+
+FootMotorDriver FootMotor(FOOT_MOTOR_ARGS);
+DomeMotorDriver DomeMotor(DOME_MOTOR_ARGS);
 
-CytronSmartDriveDuoDriver* FootMotor=&FootMotorImpl;
-CytronSmartDriveDuoDriver* DomeMotor=&DomeMotorImpl;
+#ifdef USE_SABERTOOTH_TELEMETRY
+SabertoothTelemetry FootMotorTelemetry(FOOT_MOTOR_ADDR, MOTOR_SERIAL);
 #endif
 
-#ifdef USE_PWM_DOME_MOTOR_DRIVER
-DRV8871Driver DomeMotorImpl(DOUT1_PIN, DOUT2_PIN);
-DRV8871Driver* DomeMotor=&DomeMotorImpl;
+#ifdef USE_RS485_MARCDUINO_BUS
+RS485Bus MarcduinoBus(RS485_SERIAL);
+#endif
+
+// Commands are written by transmitDomeMarcduino() and transmitBodyMarcduino() when the board is ready
+void transmitDomeMarcduino(const char* cmd);
+MarcduinoLink DomeMarcduino("Dome", transmitDomeMarcduino);
+
+#ifdef USE_BODY_MARCDUINO
+void transmitBodyMarcduino(const char* cmd);
+MarcduinoLink BodyMarcduino("Body", transmitBodyMarcduino);
 #endif
 
 ///////Setup for USB and Bluetooth Devices////////////////////////////
@@ -554,6 +817,12 @@ bool isDomeMotorStopped = true;
 
 bool overSpeedSelected = false;
 
+bool isFootMotorDerated = false;
+
+bool isIdle = false;
+uint32_t lastActivityTime = 0;
+TaskHandle_t loopTaskHandle = nullptr;
+
 bool isPS3NavigatonInitialized = false;
 bool isSecondaryPS3NavigatonInitialized = false;
 
@@ -577,6 +846,8 @@ byte action = 0;
 unsigned long DriveMillis = 0;
 
 int footDriveSpeed = 0;
+int footTurnSpeed = 0;
+int domeSpeedSetpoint = 0;
 
 // =======================================================================================
 
@@ -586,9 +857,9 @@ static const char* DEFAULT_MARCDUINO_COMMANDS[] = {
 
 bool handleMarcduinoAction(const char* action)
 {
-    String LD_text = "";
+    const char* LD_text = "";
     bool panelTypeSelected = false;
-    char buffer[1024];
+    char buffer[MARCDUINO_ACTION_MAX_LENGTH];
     snprintf(buffer, sizeof(buffer), "%s", action);
     char* cmd = buffer;
     if (*cmd == '#')
@@ -707,7 +978,7 @@ bool handleMarcduinoAction(const char* action)
                 if (num > 1)
                 {
                     sendMarcCommand(":CL00");  // close all the panels prior to next custom routine
-                    delay(50); // give panel close command time to process before starting next panel command 
+                    waitMarcReady(50); // give panel close command time to process before starting next panel command 
                 }
                 sendMarcCommand(sCommands[num-1]);
                 panelTypeSelected = true;
@@ -792,7 +1063,7 @@ bool handleMarcduinoAction(const char* action)
                 // If a custom panel movement was selected - need to briefly pause before changing light sequence to avoid conflict)
                 if (panelTypeSelected)
                 {
-                    delay(30);
+                    waitMarcReady(30);
                 }
                 switch (num)
                 {
@@ -819,10 +1090,10 @@ bool handleMarcduinoAction(const char* action)
                         break;
                     case 8:
                         sendMarcCommand("@0T100");
-                        delay(50);
-                        String custString = "@0M";
-                        custString += LD_text;
-                        sendMarcCommand(custString.c_str());
+                        waitMarcReady(50);
+                        char custString[100];
+                        snprintf(custString, sizeof(custString), "@0M%s", LD_text);
+                        sendMarcCommand(custString);
                         break;
                 }
             }
@@ -862,6 +1133,14 @@ bool handleMarcduinoAction(const char* action)
 #define MARC_SOUND_PLAYER               MarcSound::kHCR
 #include "MarcduinoSound.h"
 #define MARC_SOUND
+
+// Sound settings, loaded from preferences in setup()
+int soundPlayer = MARC_SOUND_PLAYER;
+int soundVolume = MARC_SOUND_VOLUME;
+int soundStartup = MARC_SOUND_STARTUP;
+bool soundRandom = MARC_SOUND_RANDOM;
+int soundRandomMin = MARC_SOUND_RANDOM_MIN;
+int soundRandomMax = MARC_SOUND_RANDOM_MAX;
 #endif
 
 // =======================================================================================
@@ -869,6 +1148,8 @@ bool handleMarcduinoAction(const char* action)
 // =======================================================================================
 void setup()
 {
+    // Room for a whole host protocol frame, which may arrive while loop() is busy
+    Serial.setRxBufferSize(HOST_PROTOCOL_MAX_PAYLOAD + 64);
     REELTWO_READY();
 
 #ifdef USE_PREFERENCES
@@ -878,8 +1159,8 @@ void setup()
     }
     else
     {
-        PS3ControllerFootMac = preferences.getString(PREFERENCE_PS3_FOOT_MAC, PS3_CONTROLLER_FOOT_MAC);
-        PS3ControllerDomeMAC = preferences.getString(PREFERENCE_PS3_DOME_MAC, PS3_CONTROLLER_DOME_MAC);
+        preferences.getString(PREFERENCE_PS3_FOOT_MAC, PS3ControllerFootMac, sizeof(PS3ControllerFootMac));
+        preferences.getString(PREFERENCE_PS3_DOME_MAC, PS3ControllerDomeMAC, sizeof(PS3ControllerDomeMAC));
 
         drivespeed1 = preferences.getInt(PREFERENCE_SPEED_NORMAL, DEFAULT_DRIVE_SPEED_NORMAL);
         drivespeed2 = preferences.getInt(PREFERENCE_SPEED_OVER_THROTTLE, DEFAULT_DRIVE_SPEED_OVER_THROTTLE);
@@ -894,10 +1175,21 @@ void setup()
         time360DomeTurn = preferences.getInt(PREFERENCE_DOME_DOME_TURN_TIME, DEFAULT_AUTO_DOME_TURN_TIME);
         motorControllerBaudRate = preferences.getInt(PREFERENCE_MOTOR_BAUD, DEFAULT_MOTOR_BAUD);
         marcDuinoBaudRate = preferences.getInt(PREFERENCE_MARCDUINO_BAUD, DEFAULT_MARCDUINO_BAUD);
+        minBatteryVoltage = preferences.getInt(PREFERENCE_MIN_BATTERY_VOLTAGE, DEFAULT_MIN_BATTERY_VOLTAGE);
+        maxMotorCurrent = preferences.getInt(PREFERENCE_MAX_MOTOR_CURRENT, DEFAULT_MAX_MOTOR_CURRENT);
+        deratePercent = preferences.getInt(PREFERENCE_DERATE_PERCENT, DEFAULT_DERATE_PERCENT);
+        buttonHoldTime = preferences.getInt(PREFERENCE_BUTTON_HOLD_TIME, DEFAULT_BUTTON_HOLD_TIME);
+        buttonDoubleTapTime = preferences.getInt(PREFERENCE_BUTTON_DOUBLE_TAP_TIME, DEFAULT_BUTTON_DOUBLE_TAP_TIME);
+        loopBudget = preferences.getInt(PREFERENCE_LOOP_BUDGET, DEFAULT_LOOP_BUDGET);
+        motorWatchdog = preferences.getInt(PREFERENCE_MOTOR_WATCHDOG, DEFAULT_MOTOR_WATCHDOG);
+        idleTime = preferences.getInt(PREFERENCE_IDLE_TIME, DEFAULT_IDLE_TIME);
+        MarcduinoButtonAction::loadActions();
     }
 #endif
     PrintReelTwoInfo(Serial, "Penumbra Shadow MD");
 
+    setGestureTiming();
+
     DEBUG_PRINTLN("Bluetooth Library Started");
 
     //Setup for PS3
@@ -909,14 +1201,23 @@ void setup()
     // Don't use autobaud(). It is flaky and causes delays. Default baud rate is 9600
     // If your syren is set to something else call setBaudRate(9600) below or change it
     // using Describe.
-    // FootMotor->setBaudRate(9600);   // Send the autobaud command to the Sabertooth controller(s).
-    FootMotor->setTimeout(10);      //DMB:  How low can we go for safety reasons?  multiples of 100ms
-    FootMotor->setDeadband(driveDeadBandRange);
-    FootMotor->stop();
-    DomeMotor->setTimeout(20);      //DMB:  How low can we go for safety reasons?  multiples of 100ms
-    DomeMotor->setRamping(0.8);
-    // DomeMotor->stop();
-
+    // FootMotor.setBaudRate(9600);   // Send the autobaud command to the Sabertooth controller(s).
+#ifdef USE_SABERTOOTH_TELEMETRY
+    FootMotorTelemetry.setBaudRate(motorControllerBaudRate);
+    FootMotorTelemetry.setPollInterval(DEFAULT_TELEMETRY_INTERVAL);
+#endif
+    FootMotor.setTimeout(10);      //DMB:  How low can we go for safety reasons?  multiples of 100ms
+    FootMotor.setDeadband(driveDeadBandRange);
+    FootMotor.stop();
+    DomeMotor.setTimeout(20);      //DMB:  How low can we go for safety reasons?  multiples of 100ms
+    DomeMotor.setRamping(0.8);
+    // DomeMotor.stop();
+
+#ifdef USE_RS485_MARCDUINO_BUS
+    //Setup for the RS-485 bus shared by the dome and body MarcDuino Control Boards
+    RS485_SERIAL_INIT(marcDuinoBaudRate);
+    MarcduinoBus.setReplyHandler(marcduinoBusReply);
+#else
     // //Setup for MD_SERIAL MarcDuino Dome Control Board
     MD_SERIAL_INIT(marcDuinoBaudRate);
 
@@ -924,6 +1225,12 @@ void setup()
 #if defined(ENABLE_BODY_MD_SERIAL)
     BODY_MD_SERIAL_INIT(marcDuinoBaudRate);
 #endif
+#endif
+
+    DomeMarcduino.setReplyHandler(printMarcduinoReply);
+#ifdef USE_BODY_MARCDUINO
+    BodyMarcduino.setReplyHandler(printMarcduinoReply);
+#endif
 
     // randomSeed(analogRead(0));  // random number seed for dome automation   
 
@@ -931,13 +1238,17 @@ void setup()
 
 #if defined(MARC_SOUND_PLAYER)
     SOUND_SERIAL_INIT(SOUND_SERIAL_BAUD);
-    MarcSound::Module soundPlayer = (MarcSound::Module)preferences.getInt(PREFERENCE_MARCSOUND, MARC_SOUND_PLAYER);
-    int soundStartup = preferences.getInt(PREFERENCE_MARCSOUND_STARTUP, MARC_SOUND_STARTUP);
-    if (!sMarcSound.begin(soundPlayer, SOUND_SERIAL, soundStartup))
+    soundPlayer = preferences.getInt(PREFERENCE_MARCSOUND, MARC_SOUND_PLAYER);
+    soundStartup = preferences.getInt(PREFERENCE_MARCSOUND_STARTUP, MARC_SOUND_STARTUP);
+    soundVolume = preferences.getInt(PREFERENCE_MARCSOUND_VOLUME, MARC_SOUND_VOLUME);
+    soundRandom = preferences.getBool(PREFERENCE_MARCSOUND_RANDOM, MARC_SOUND_RANDOM);
+    soundRandomMin = preferences.getInt(PREFERENCE_MARCSOUND_RANDOM_MIN, MARC_SOUND_RANDOM_MIN);
+    soundRandomMax = preferences.getInt(PREFERENCE_MARCSOUND_RANDOM_MAX, MARC_SOUND_RANDOM_MAX);
+    if (!sMarcSound.begin((MarcSound::Module)soundPlayer, SOUND_SERIAL, soundStartup))
     {
         DEBUG_PRINTLN("FAILED TO INITALIZE SOUND MODULE");
     }
-    sMarcSound.setVolume(preferences.getInt(PREFERENCE_MARCSOUND_VOLUME, MARC_SOUND_VOLUME) / 1000.0);
+    sMarcSound.setVolume(soundVolume / 1000.0);
 #endif
 
     if (Usb.Init() == -1)
@@ -947,28 +1258,116 @@ void setup()
     }
 #if defined(MARC_SOUND_PLAYER)
     sMarcSound.playStartSound();
-    sMarcSound.setRandomMin(preferences.getInt(PREFERENCE_MARCSOUND_RANDOM_MIN, MARC_SOUND_RANDOM_MIN));
-    sMarcSound.setRandomMax(preferences.getInt(PREFERENCE_MARCSOUND_RANDOM_MAX, MARC_SOUND_RANDOM_MAX));
-    if (preferences.getBool(PREFERENCE_MARCSOUND_RANDOM, MARC_SOUND_RANDOM))
+    sMarcSound.setRandomMin(soundRandomMin);
+    sMarcSound.setRandomMax(soundRandomMax);
+    if (soundRandom)
         sMarcSound.startRandomInSeconds(13);
 #endif
+
+    // Console input wakes loop() early while idle. HardwareSerial::onReceive() first shipped
+    // in arduino-esp32 2.0.3, older board packages just wait for the idle tick
+    loopTaskHandle = xTaskGetCurrentTaskHandle();
+#ifdef ESP_ARDUINO_VERSION_VAL
+#if ESP_ARDUINO_VERSION >= ESP_ARDUINO_VERSION_VAL(2, 0, 3)
+    Serial.onReceive(wakeLoop);
+#endif
+#endif
+
+    // Arm the loop deadline monitor and motor watchdog last so setup time is not counted
+    sLoopMonitor.begin(loopBudget, motorWatchdog, emergencyStopMotors);
 }
 
-void sendMarcCommand(const char* cmd)
+////////////////////////////////
+// Called from the motor watchdog task when loop() has missed its deadline. Each stop
+// takes the motor port lock, so it is sent after any packet the loop task is writing
+void emergencyStopMotors()
 {
-    SHADOW_VERBOSE("Sending MARC: \"%s\"\n", cmd)
+    FootMotor.stop();
+    DomeMotor.stop();
+}
+
+////////////////////////////////
+// Write one command to the dome MarcDuino. Called by DomeMarcduino when the board is ready,
+// so a sound played by the local sound player starts together with the board's action
+void transmitDomeMarcduino(const char* cmd)
+{
+#ifdef USE_RS485_MARCDUINO_BUS
+    MarcduinoBus.send(DOME_MARCDUINO_ADDR, cmd);
+#else
     MD_SERIAL.print(cmd); MD_SERIAL.print("\r");
+#endif
 #if defined(MARC_SOUND_PLAYER)
     sMarcSound.handleCommand(cmd);
 #endif
 }
 
+#ifdef USE_BODY_MARCDUINO
+////////////////////////////////
+// Write one command to the body MarcDuino. Called by BodyMarcduino when the board is ready
+void transmitBodyMarcduino(const char* cmd)
+{
+#ifdef USE_RS485_MARCDUINO_BUS
+    MarcduinoBus.send(BODY_MARCDUINO_ADDR, cmd);
+#else
+    BODY_MD_SERIAL.print(cmd); BODY_MD_SERIAL.print("\r");
+#endif
+}
+#endif
+
+void sendMarcCommand(const char* cmd)
+{
+    SHADOW_VERBOSE("Sending MARC: \"%s\"\n", cmd)
+    DomeMarcduino.send(cmd);
+}
+
 void sendBodyMarcCommand(const char* cmd)
 {
-#if defined(ENABLE_BODY_MD_SERIAL)
+#ifdef USE_BODY_MARCDUINO
     SHADOW_VERBOSE("Sending BODYMARC: \"%s\"\n", cmd)
-    BODY_MD_SERIAL.print(cmd); BODY_MD_SERIAL.print("\r");
+    BodyMarcduino.send(cmd);
+#endif
+}
+
+////////////////////////////////
+// Hold later dome MarcDuino commands until the board has answered the ones already sent.
+// Boards that do not answer are given fallbackMs instead.
+void waitMarcReady(uint32_t fallbackMs)
+{
+    DomeMarcduino.waitReady(fallbackMs);
+}
+
+////////////////////////////////
+// Reply line received from a MarcDuino board
+void printMarcduinoReply(const char* name, const char* line)
+{
+    printf("%s MD: %s\n", name, line);
+}
+
+#ifdef USE_RS485_MARCDUINO_BUS
+////////////////////////////////
+// Reply frame sent back by a board on the RS-485 bus
+void marcduinoBusReply(uint8_t address, const uint8_t* payload, uint8_t length)
+{
+    char line[RS485_MAX_PAYLOAD + 1];
+    memcpy(line, payload, length);
+    line[length] = '\0';
+    if (address == DOME_MARCDUINO_ADDR)
+        DomeMarcduino.reply(line, millis());
+    else if (address == BODY_MARCDUINO_ADDR)
+        BodyMarcduino.reply(line, millis());
+}
 #endif
+
+////////////////////////////////
+// Trim leading and trailing whitespace in place
+char* trimCommand(char* str)
+{
+    while (isspace(*str))
+        str++;
+    char* end = str + strlen(str);
+    while (end > str && isspace(end[-1]))
+        *--end = '\0';
+    return str;
 }
 
 ////////////////////////////////
@@ -982,70 +1381,941 @@ void reboot()
 }
 
 // =======================================================================================
-//           Main Program Loop - This is the recurring check loop for entire sketch
+//           Idle Mode
+//
+//    With no controller connected and no console traffic for idleTime seconds loop()
+//    blocks for IDLE_LOOP_TICK between passes instead of spinning. The CPU sits in the
+//    FreeRTOS idle task meanwhile. USB polling, sounds, panel routines and auto dome all
+//    run from millis() so they keep their own schedules at the lower rate. The CPU clock
+//    is left alone since the software serial ports depend on it.
+//
+//    The saving is limited to the CPU waiting in WFI instead of spinning. There is no
+//    light sleep and no power management lock is released: the clock stays at full rate,
+//    and Bluetooth and the USB host shield stay powered, so most of the draw remains.
+//
+//    An incoming Bluetooth connection or console input ends idle on the next pass.
 // =======================================================================================
 
-void loop()
+// Called from the UART event task when console data arrives
+void wakeLoop()
 {
-#ifdef USE_PWM_DOME_MOTOR_DRIVER
-    DomeMotor->task();
-#endif
-    //LOOP through functions from highest to lowest priority.
-    if (!readUSB())
-        return;
-    
-    footMotorDrive();
-    domeDrive();
-    marcDuinoDome();
-    marcDuinoFoot();
-    toggleSettings();
-    custMarcDuinoPanel();     
-#if defined(MARC_SOUND_PLAYER)
-    sMarcSound.idle();
+    if (loopTaskHandle != nullptr)
+        xTaskNotifyGive(loopTaskHandle);
+}
+
+// True while the Bluetooth dongle is in the middle of accepting a controller connection
+bool isControllerConnecting()
+{
+    return (Usb.getUsbTaskState() == USB_STATE_RUNNING && !Btd.watingForConnection);
+}
+
+void idleSleep()
+{
+    uint32_t now = millis();
+    if (idleTime == 0 ||
+        PS3NavFoot->PS3NavigationConnected ||
+        PS3NavDome->PS3NavigationConnected ||
+        isControllerConnecting() ||
+        Serial.available())
+    {
+        lastActivityTime = now;
+    }
+    bool idle = (now - lastActivityTime >= uint32_t(idleTime) * 1000);
+    if (idle != isIdle)
+    {
+        isIdle = idle;
+        sLoopMonitor.setMode(idle ? ControlLoopMonitor::kIdle : ControlLoopMonitor::kActive);
+        SHADOW_VERBOSE(idle ? "Idle\n" : "Active\n")
+    }
+    if (isIdle)
+    {
+        uint32_t tick = IDLE_LOOP_TICK;
+        if (motorWatchdog != 0)
+            tick = min(tick, uint32_t(motorWatchdog / 4));
+        sLoopMonitor.sleepBegin();
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(tick));
+    }
+}
+
+// =======================================================================================
+//           Binary Host Protocol
+//
+//    Framed, CRC checked messages on the console serial port (see HostProtocol.h) for
+//    bulk transfer of settings and button actions. Changes are staged between BEGIN
+//    and COMMIT and applied together on COMMIT, ABORT drops them.
+//
+//    HELLO          u8 version -> u8 status, u8 version, u8 settings, u16 action entries,
+//                                 u16 max payload, str firmware
+//    GET_SETTINGS   -> u8 status, u8 count, { u8 id, i32 value, i32 min, i32 max }
+//    GET_ACTIONS    u16 start -> u8 status, u16 total, u16 next, u8 count,
+//                                 { u8 gesture, str trigger, str action }
+//    BEGIN          -> u8 status
+//    SET_SETTINGS   { u8 id, i32 value } -> u8 status, u8 index
+//    SET_ACTIONS    { u8 gesture, str trigger, str action } -> u8 status, u8 index
+//                   (a .hold or .dtap suffix on trigger must agree with gesture)
+//    COMMIT         -> u8 status, u8 settings, u16 actions, u8 flags
+//                   (flag 0x01: a changed setting only takes effect after a reboot)
+//    ABORT          -> u8 status
+//    STREAM         u8 hz -> u8 status          (0 stops the telemetry stream)
+//
+//    Strings are a varint length followed by the characters, without a terminator.
+//    TELEMETRY frames are sent unsolicited while the stream is running.
+// =======================================================================================
+enum HostMessage
+{
+    kHostHello = 0x01,
+    kHostGetSettings = 0x02,
+    kHostGetActions = 0x03,
+    kHostBegin = 0x04,
+    kHostSetSettings = 0x05,
+    kHostSetActions = 0x06,
+    kHostCommit = 0x07,
+    kHostAbort = 0x08,
+    kHostStream = 0x09,
+    kHostTelemetry = 0x40,
+    kHostReply = 0x80
+};
+
+enum HostStatus
+{
+    kHostOK,
+    kHostUnknownMessage,
+    kHostBadPayload,
+    kHostBadValue,
+    kHostNoTransaction,
+    kHostStagingFull,
+    kHostUnknownTrigger,
+    kHostVersionMismatch
+};
+
+enum HostCommitFlags
+{
+    kHostCommitNeedsRestart = 0x01
+};
+
+struct HostSetting
+{
+    enum Type
+    {
+        kByte,
+        kInt,
+        kBool
+    };
+    uint8_t fID;
+    const char* fKey;
+    Type fType;
+    void* fValue;
+    int32_t fMin;
+    int32_t fMax;
+    bool fRestart;
+};
+
+// IDs are part of the protocol. Never renumber, only append. Ranges match the console
+// commands, except the motor watchdog which can only be disabled with #SMWATCHDOG0.
+// Settings marked restart are only read in setup() and take effect after a reboot.
+// The controller MAC addresses are left out on purpose: they pair this board with
+// particular controllers and are learned when a controller first connects.
+static const HostSetting sHostSettings[] = {
+    {  1, PREFERENCE_SPEED_NORMAL,           HostSetting::kByte, &drivespeed1,               0,   127,    false },
+    {  2, PREFERENCE_SPEED_OVER_THROTTLE,    HostSetting::kByte, &drivespeed2,               0,   127,    false },
+    {  3, PREFERENCE_TURN_SPEED,             HostSetting::kByte, &turnspeed,                 0,   127,    false },
+    {  4, PREFERENCE_DOME_SPEED,             HostSetting::kByte, &domespeed,                 0,   127,    false },
+    {  5, PREFERENCE_RAMPING,                HostSetting::kByte, &ramping,                   0,   10,     false },
+    {  6, PREFERENCE_FOOTSTICK_DEADBAND,     HostSetting::kByte, &joystickFootDeadZoneRange, 0,   127,    false },
+    {  7, PREFERENCE_DOMESTICK_DEADBAND,     HostSetting::kByte, &joystickDomeDeadZoneRange, 0,   127,    false },
+    {  8, PREFERENCE_DRIVE_DEADBAND,         HostSetting::kByte, &driveDeadBandRange,        0,   127,    false },
+    {  9, PREFERENCE_INVERT_TURN_DIRECTION,  HostSetting::kBool, &invertTurnDirection,       0,   1,      false },
+    { 10, PREFERENCE_DOME_AUTO_SPEED,        HostSetting::kByte, &domeAutoSpeed,             50,  100,    false },
+    { 11, PREFERENCE_DOME_DOME_TURN_TIME,    HostSetting::kInt,  &time360DomeTurn,           2500, 8000,   false },
+    { 12, PREFERENCE_MOTOR_BAUD,             HostSetting::kInt,  &motorControllerBaudRate,   2400, 115200, true  },
+    { 13, PREFERENCE_MARCDUINO_BAUD,         HostSetting::kInt,  &marcDuinoBaudRate,         2400, 115200, true  },
+    { 14, PREFERENCE_MIN_BATTERY_VOLTAGE,    HostSetting::kInt,  &minBatteryVoltage,         0,   600,    false },
+    { 15, PREFERENCE_MAX_MOTOR_CURRENT,      HostSetting::kInt,  &maxMotorCurrent,           0,   1000,   false },
+    { 16, PREFERENCE_DERATE_PERCENT,         HostSetting::kInt,  &deratePercent,             0,   100,    false },
+    { 17, PREFERENCE_BUTTON_HOLD_TIME,       HostSetting::kInt,  &buttonHoldTime,            100, 5000,   false },
+    { 18, PREFERENCE_BUTTON_DOUBLE_TAP_TIME, HostSetting::kInt,  &buttonDoubleTapTime,       50,  2000,   false },
+    { 19, PREFERENCE_LOOP_BUDGET,            HostSetting::kInt,  &loopBudget,                1,   1000,   false },
+    { 20, PREFERENCE_MOTOR_WATCHDOG,         HostSetting::kInt,  &motorWatchdog,             50,  5000,   false },
+    { 21, PREFERENCE_IDLE_TIME,              HostSetting::kInt,  &idleTime,                  0,   3600,   false },
+#ifdef MARC_SOUND
+    { 22, PREFERENCE_MARCSOUND,              HostSetting::kInt,  &soundPlayer,               0,   3,      true  },
+    { 23, PREFERENCE_MARCSOUND_VOLUME,       HostSetting::kInt,  &soundVolume,               0,   1000,   false },
+    { 24, PREFERENCE_MARCSOUND_STARTUP,      HostSetting::kInt,  &soundStartup,              0,   65535,  true  },
+    { 25, PREFERENCE_MARCSOUND_RANDOM,       HostSetting::kBool, &soundRandom,               0,   1,      false },
+    { 26, PREFERENCE_MARCSOUND_RANDOM_MIN,   HostSetting::kInt,  &soundRandomMin,            0,   600000, false },
+    { 27, PREFERENCE_MARCSOUND_RANDOM_MAX,   HostSetting::kInt,  &soundRandomMax,            0,   600000, false },
 #endif
+};
 
-    // If dome automation is enabled - Call function
-    if (domeAutomation && time360DomeTurn > 1999 && time360DomeTurn < 8001 && domeAutoSpeed > 49 && domeAutoSpeed < 101)  
+#define HOST_STAGED_ACTIONS     (3 * 64)
+#define HOST_STAGING_POOL       4096
+
+struct HostStagedAction
+{
+    MarcduinoButtonAction* fButton;
+    ButtonGesture fGesture;
+    uint16_t fOffset;
+};
+
+struct HostTransaction
+{
+    bool fActive = false;
+    bool fStaged[SizeOfArray(sHostSettings)];
+    int32_t fValue[SizeOfArray(sHostSettings)];
+    unsigned fActionCount = 0;
+    HostStagedAction fActions[HOST_STAGED_ACTIONS];
+    unsigned fPoolUsed = 0;
+    char fPool[HOST_STAGING_POOL];
+};
+
+HostProtocol sHostProtocol;
+static HostTransaction sHostTransaction;
+static uint8_t sHostReply[HOST_PROTOCOL_MAX_PAYLOAD];
+
+// Returns the table index of the setting or -1
+int findHostSetting(uint8_t id)
+{
+    for (unsigned i = 0; i < SizeOfArray(sHostSettings); i++)
     {
-       autoDome(); 
+        if (sHostSettings[i].fID == id)
+            return i;
     }
+    return -1;
+}
 
-    if (Serial.available())
+int32_t getHostSetting(unsigned index)
+{
+    const HostSetting &setting = sHostSettings[index];
+    switch (setting.fType)
     {
-        int ch = Serial.read();
-        MD_SERIAL.print((char)ch);
-        if (ch == 0x0A || ch == 0x0D)
+        case HostSetting::kByte:
+            return *(byte*)setting.fValue;
+        case HostSetting::kInt:
+            return *(int*)setting.fValue;
+        case HostSetting::kBool:
+            return *(bool*)setting.fValue;
+    }
+    return 0;
+}
+
+void setHostSetting(unsigned index, int32_t value)
+{
+    const HostSetting &setting = sHostSettings[index];
+    switch (setting.fType)
+    {
+        case HostSetting::kByte:
+            *(byte*)setting.fValue = value;
+            preferences.putInt(setting.fKey, value);
+            break;
+        case HostSetting::kInt:
+            *(int*)setting.fValue = value;
+            preferences.putInt(setting.fKey, value);
+            break;
+        case HostSetting::kBool:
+            *(bool*)setting.fValue = (value != 0);
+            preferences.putBool(setting.fKey, value != 0);
+            break;
+    }
+}
+
+void beginHostTransaction()
+{
+    HostTransaction &t = sHostTransaction;
+    t.fActive = true;
+    t.fActionCount = 0;
+    t.fPoolUsed = 0;
+    for (unsigned i = 0; i < SizeOfArray(t.fStaged); i++)
+        t.fStaged[i] = false;
+}
+
+void commitHostTransaction(HostPayloadWriter &reply)
+{
+    HostTransaction &t = sHostTransaction;
+    unsigned settings = 0;
+    uint8_t flags = 0;
+    for (unsigned i = 0; i < SizeOfArray(sHostSettings); i++)
+    {
+        if (t.fStaged[i])
         {
-            char* cmd = sBuffer;
-            if (startswith(cmd, "#SMZERO"))
+            if (sHostSettings[i].fRestart && getHostSetting(i) != t.fValue[i])
+                flags |= kHostCommitNeedsRestart;
+            setHostSetting(i, t.fValue[i]);
+            settings++;
+        }
+    }
+    for (unsigned i = 0; i < t.fActionCount; i++)
+    {
+        HostStagedAction &staged = t.fActions[i];
+        staged.fButton->setAction(&t.fPool[staged.fOffset], staged.fGesture);
+    }
+    setGestureTiming();
+    sLoopMonitor.setBudget(loopBudget);
+    sLoopMonitor.setWatchdog(motorWatchdog);
+#ifdef MARC_SOUND
+    sMarcSound.setVolume(soundVolume / 1000.0);
+    sMarcSound.setRandomMin(soundRandomMin);
+    sMarcSound.setRandomMax(soundRandomMax);
+    if (soundRandom != sMarcSound.randomEnabled())
+    {
+        if (soundRandom)
+            sMarcSound.startRandom();
+        else
+            sMarcSound.stopRandom();
+    }
+#endif
+    reply.u8(kHostOK);
+    reply.u8(settings);
+    reply.u16(t.fActionCount);
+    reply.u8(flags);
+    t.fActive = false;
+}
+
+void stageHostSettings(HostPayloadReader &req, HostPayloadWriter &reply)
+{
+    HostTransaction &t = sHostTransaction;
+    // Validate the whole frame before staging any of it
+    for (unsigned pass = 0; pass < 2; pass++)
+    {
+        HostPayloadReader entries = req;
+        uint8_t index = 0;
+        while (!entries.atEnd())
+        {
+            uint8_t id = entries.u8();
+            int32_t value = entries.i32();
+            int settingIndex = findHostSetting(id);
+            if (!entries.ok())
             {
-                preferences.clear();
-                DEBUG_PRINT("Clearing preferences. ");
-                reboot();
+                reply.u8(kHostBadPayload);
+                reply.u8(index);
+                return;
             }
-            else if (startswith(cmd, "#SMRESTART"))
+            if (settingIndex < 0 ||
+                value < sHostSettings[settingIndex].fMin ||
+                value > sHostSettings[settingIndex].fMax)
             {
-                reboot();
+                reply.u8(kHostBadValue);
+                reply.u8(index);
+                return;
             }
-            else if (startswith(cmd, "#SMLIST"))
+            if (pass == 1)
             {
-                printf("Button Actions\n");
-                printf("-----------------------------------\n");
-                MarcduinoButtonAction::listActions();
+                t.fStaged[settingIndex] = true;
+                t.fValue[settingIndex] = value;
             }
-            else if (startswith(cmd, "#SMDEL"))
+            index++;
+        }
+        if (pass == 1)
+        {
+            reply.u8(kHostOK);
+            reply.u8(index);
+        }
+    }
+}
+
+void stageHostActions(HostPayloadReader &req, HostPayloadWriter &reply)
+{
+    HostTransaction &t = sHostTransaction;
+    unsigned actionCount = t.fActionCount;
+    unsigned poolUsed = t.fPoolUsed;
+    uint8_t index = 0;
+    uint8_t status = kHostOK;
+    while (!req.atEnd())
+    {
+        char name[64];
+        char* action = &t.fPool[poolUsed];
+        uint8_t gesture = req.u8();
+        req.str(name, sizeof(name));
+        size_t room = min(sizeof(t.fPool) - poolUsed, size_t(MARCDUINO_ACTION_MAX_LENGTH));
+        if (!req.ok() || gesture >= kGestureCount)
+        {
+            status = kHostBadPayload;
+            break;
+        }
+        if (actionCount >= SizeOfArray(t.fActions))
+        {
+            status = kHostStagingFull;
+            break;
+        }
+        if (!req.str(action, room))
+        {
+            status = (room < MARCDUINO_ACTION_MAX_LENGTH) ? kHostStagingFull : kHostBadValue;
+            break;
+        }
+        ButtonGesture nameGesture;
+        MarcduinoButtonAction* btn = MarcduinoButtonAction::findAction(name, nameGesture);
+        if (btn == nullptr)
+        {
+            status = kHostUnknownTrigger;
+            break;
+        }
+        if (nameGesture != kGestureTap && nameGesture != gesture)
+        {
+            status = kHostBadValue;
+            break;
+        }
+        HostStagedAction &staged = t.fActions[actionCount++];
+        staged.fButton = btn;
+        staged.fGesture = ButtonGesture(gesture);
+        staged.fOffset = poolUsed;
+        poolUsed += strlen(action) + 1;
+        index++;
+    }
+    // A frame is staged completely or not at all
+    if (status == kHostOK)
+    {
+        t.fActionCount = actionCount;
+        t.fPoolUsed = poolUsed;
+    }
+    reply.u8(status);
+    reply.u8(index);
+}
+
+void getHostActions(HostPayloadReader &req, HostPayloadWriter &reply)
+{
+    uint16_t start = req.u16();
+    uint16_t total = MarcduinoButtonAction::count() * kGestureCount;
+    // status, total, next, count
+    reply.u8(kHostOK);
+    reply.u16(total);
+    uint8_t* nextp = reply.data() + reply.length();
+    reply.u16(total);
+    uint8_t* countp = reply.data() + reply.length();
+    reply.u8(0);
+    uint16_t entry = 0;
+    uint8_t count = 0;
+    for (MarcduinoButtonAction* btn = MarcduinoButtonAction::first(); btn != nullptr; btn = btn->next())
+    {
+        for (unsigned i = 0; i < kGestureCount; i++, entry++)
+        {
+            if (entry < start)
+                continue;
+            ButtonGesture gesture = ButtonGesture(i);
+            const char* action = btn->action(gesture);
+            if (count == 255 || reply.remaining() < 5 + strlen(btn->name()) + strlen(action))
+            {
+                nextp[0] = uint8_t(entry);
+                nextp[1] = uint8_t(entry >> 8);
+                *countp = count;
+                return;
+            }
+            reply.u8(gesture);
+            reply.str(btn->name());
+            reply.str(action);
+            count++;
+        }
+    }
+    *countp = count;
+}
+
+void handleHostFrame()
+{
+    HostPayloadReader req(sHostProtocol.payload(), sHostProtocol.length());
+    HostPayloadWriter reply(sHostReply, sizeof(sHostReply));
+    uint8_t type = sHostProtocol.type();
+    switch (type)
+    {
+        case kHostHello:
+        {
+            uint8_t version = req.u8();
+            reply.u8((version == HOST_PROTOCOL_VERSION) ? kHostOK : kHostVersionMismatch);
+            reply.u8(HOST_PROTOCOL_VERSION);
+            reply.u8(SizeOfArray(sHostSettings));
+            reply.u16(MarcduinoButtonAction::count() * kGestureCount);
+            reply.u16(HOST_PROTOCOL_MAX_PAYLOAD);
+            reply.str("Penumbra Shadow MD");
+            break;
+        }
+        case kHostGetSettings:
+            reply.u8(kHostOK);
+            reply.u8(SizeOfArray(sHostSettings));
+            for (unsigned i = 0; i < SizeOfArray(sHostSettings); i++)
+            {
+                const HostSetting &setting = sHostSettings[i];
+                reply.u8(setting.fID);
+                reply.i32(getHostSetting(i));
+                reply.i32(setting.fMin);
+                reply.i32(setting.fMax);
+            }
+            break;
+        case kHostGetActions:
+            getHostActions(req, reply);
+            break;
+        case kHostBegin:
+            beginHostTransaction();
+            reply.u8(kHostOK);
+            break;
+        case kHostSetSettings:
+            if (!sHostTransaction.fActive)
+                reply.u8(kHostNoTransaction);
+            else
+                stageHostSettings(req, reply);
+            break;
+        case kHostSetActions:
+            if (!sHostTransaction.fActive)
+                reply.u8(kHostNoTransaction);
+            else
+                stageHostActions(req, reply);
+            break;
+        case kHostCommit:
+            if (!sHostTransaction.fActive)
+                reply.u8(kHostNoTransaction);
+            else
+                commitHostTransaction(reply);
+            break;
+        case kHostAbort:
+            sHostTransaction.fActive = false;
+            reply.u8(kHostOK);
+            break;
+        case kHostStream:
+        {
+            uint8_t hz = req.u8();
+            if (!req.ok())
+            {
+                reply.u8(kHostBadPayload);
+            }
+            else if (hz > TELEMETRY_MAX_RATE)
+            {
+                reply.u8(kHostBadValue);
+            }
+            else
+            {
+                setTelemetryRate(hz);
+                reply.u8(kHostOK);
+            }
+            break;
+        }
+        default:
+            reply.u8(kHostUnknownMessage);
+            break;
+    }
+    HostProtocol::send(Serial, type | kHostReply, sHostProtocol.seq(), reply.data(), reply.length());
+}
+
+// =======================================================================================
+//           Telemetry Stream
+//
+//    Delta-encoded status frames (see TelemetryStream.h) sent as host protocol frames of
+//    type kHostTelemetry at #SMSTREAM frames per second. tools/shadow_telemetry.py decodes
+//    them. Field numbers are part of the stream format. Never reorder, only append.
+// =======================================================================================
+enum TelemetryField
+{
+    kTelemetryTime,             // millis()
+    kTelemetryFootSpeed,        // footDriveSpeed
+    kTelemetryFootTurn,         // last turn value sent to the foot motors
+    kTelemetryDomeSpeed,        // last dome motor setpoint
+    kTelemetryDomePWM,          // DRV8871 PWM currently applied (-255..255)
+    kTelemetryDomeStatus,       // auto dome: 0 stopped, 1 prepare to turn, 2 turning
+    kTelemetryDomeTarget,       // auto dome target position in degrees
+    kTelemetryFlags,            // kTelemetryFlag bits
+    kTelemetryPanelsWaiting,    // bit per panel waiting for its start delay
+    kTelemetryPanelsOpen,       // bit per panel open for its duration
+    kTelemetrySound,            // file number of the last sound played
+    kTelemetrySoundCount,       // sounds played since startup
+    kTelemetryLoopIterations,   // loop passes since startup
+    kTelemetryLoopOverruns,     // loop passes over budget since startup
+    kTelemetryLoopMaxPass,      // slowest loop pass since the previous frame in us
+    kTelemetryWatchdogTrips,    // motor watchdog trips since startup
+    kTelemetryFieldCount
+};
+
+enum TelemetryFlag
+{
+    kTelemetryFootConnected = 1 << 0,
+    kTelemetryDomeConnected = 1 << 1,
+    kTelemetryFootStopped = 1 << 2,
+    kTelemetryDomeStopped = 1 << 3,
+    kTelemetryDerated = 1 << 4,
+    kTelemetryIdle = 1 << 5,
+    kTelemetryAutoDome = 1 << 6,
+    kTelemetryOverSpeed = 1 << 7,
+    kTelemetryRandomSound = 1 << 8
+};
+
+TelemetryStream<kTelemetryFieldCount> sTelemetry;
+
+void setTelemetryRate(uint32_t hz)
+{
+    sTelemetry.setRate(hz);
+}
+
+void sendTelemetry()
+{
+    uint32_t now = millis();
+    if (!sTelemetry.due(now))
+        return;
+
+    uint32_t flags = 0;
+    if (PS3NavFoot->PS3NavigationConnected)
+        flags |= kTelemetryFootConnected;
+    if (PS3NavDome->PS3NavigationConnected)
+        flags |= kTelemetryDomeConnected;
+    if (isFootMotorStopped)
+        flags |= kTelemetryFootStopped;
+    if (domeSpeedSetpoint == 0)
+        flags |= kTelemetryDomeStopped;
+    if (isFootMotorDerated)
+        flags |= kTelemetryDerated;
+    if (isIdle)
+        flags |= kTelemetryIdle;
+    if (domeAutomation)
+        flags |= kTelemetryAutoDome;
+    if (overSpeedSelected)
+        flags |= kTelemetryOverSpeed;
+
+    uint32_t panelsWaiting = 0;
+    uint32_t panelsOpen = 0;
+    for (unsigned i = 0; i < SizeOfArray(sPanelStatus); i++)
+    {
+        if (sPanelStatus[i].fStatus == 1)
+            panelsWaiting |= 1UL << i;
+        else if (sPanelStatus[i].fStatus == 2)
+            panelsOpen |= 1UL << i;
+    }
+
+    sTelemetry.set(kTelemetryTime, now);
+    sTelemetry.set(kTelemetryFootSpeed, footDriveSpeed);
+    sTelemetry.set(kTelemetryFootTurn, isFootMotorStopped ? 0 : footTurnSpeed);
+    sTelemetry.set(kTelemetryDomeSpeed, domeSpeedSetpoint);
+#ifdef USE_PWM_DOME_MOTOR_DRIVER
+    sTelemetry.set(kTelemetryDomePWM, DomeMotor.driver().getCurrentPWM());
+#endif
+    sTelemetry.set(kTelemetryDomeStatus, domeStatus);
+    sTelemetry.set(kTelemetryDomeTarget, int32_t(domeTargetPosition));
+    sTelemetry.set(kTelemetryPanelsWaiting, panelsWaiting);
+    sTelemetry.set(kTelemetryPanelsOpen, panelsOpen);
+#if defined(MARC_SOUND_PLAYER)
+    if (sMarcSound.randomEnabled())
+        flags |= kTelemetryRandomSound;
+    sTelemetry.set(kTelemetrySound, sMarcSound.lastSound());
+    sTelemetry.set(kTelemetrySoundCount, sMarcSound.soundCount());
+#endif
+    sTelemetry.set(kTelemetryFlags, flags);
+    sTelemetry.set(kTelemetryLoopIterations, sLoopMonitor.iterations());
+    sTelemetry.set(kTelemetryLoopOverruns, sLoopMonitor.overruns());
+    sTelemetry.set(kTelemetryLoopMaxPass, sLoopMonitor.takeRecentMaxPassUs());
+    sTelemetry.set(kTelemetryWatchdogTrips, sLoopMonitor.watchdogTrips());
+    sTelemetry.send(Serial, kHostTelemetry);
+}
+
+// =======================================================================================
+//           Main Program Loop - This is the recurring check loop for entire sketch
+// =======================================================================================
+
+void loop()
+{
+    idleSleep();
+#ifdef USE_ALLOCATION_COUNTER
+    sAllocationCounter.loopBegin();
+#endif
+    sLoopMonitor.loopBegin();
+    DomeMotor.task();
+    sLoopMonitor.mark(ControlLoopMonitor::kMotorTask);
+
+    //LOOP through functions from highest to lowest priority.
+    bool usbReady = readUSB();
+    sLoopMonitor.mark(ControlLoopMonitor::kUSB);
+    // Ahead of the USB check so the stream keeps running while the USB host is down
+    sendTelemetry();
+    sLoopMonitor.mark(ControlLoopMonitor::kStream);
+    if (!usbReady)
+        return;
+    
+    footMotorDrive();
+    sLoopMonitor.mark(ControlLoopMonitor::kFootDrive);
+    domeDrive();
+    sLoopMonitor.mark(ControlLoopMonitor::kDomeDrive);
+#ifdef USE_SABERTOOTH_TELEMETRY
+    motorTelemetry();
+    sLoopMonitor.mark(ControlLoopMonitor::kTelemetry);
+#endif
+    readButtons();
+    marcDuinoDome();
+    marcDuinoFoot();
+    sLoopMonitor.mark(ControlLoopMonitor::kMarcduino);
+    toggleSettings();
+    sLoopMonitor.mark(ControlLoopMonitor::kToggle);
+    custMarcDuinoPanel();     
+    sLoopMonitor.mark(ControlLoopMonitor::kPanels);
+#if defined(MARC_SOUND_PLAYER)
+    sMarcSound.idle();
+    sLoopMonitor.mark(ControlLoopMonitor::kSound);
+#endif
+
+    // If dome automation is enabled - Call function
+    if (domeAutomation && time360DomeTurn > 1999 && time360DomeTurn < 8001 && domeAutoSpeed > 49 && domeAutoSpeed < 101)  
+    {
+       autoDome(); 
+    }
+    sLoopMonitor.mark(ControlLoopMonitor::kAutoDome);
+
+    // Binary host protocol frames are drained completely. Text is handled one byte per pass.
+    while (Serial.available() && (sHostProtocol.receiving() || Serial.peek() == HOST_PROTOCOL_SYNC))
+    {
+        if (sHostProtocol.receive(Serial.read(), millis()))
+            handleHostFrame();
+    }
+    if (Serial.available())
+    {
+        int ch = Serial.read();
+        if (ch == 0x0A || ch == 0x0D)
+        {
+            char* cmd = sBuffer;
+            // Other lines are passed on to the dome MarcDuino through DomeMarcduino, so
+            // their replies are matched like any other command
+            if (sPos != 0 && strncmp(sBuffer, "#SM", 3) != 0)
+                DomeMarcduino.send(sBuffer);
+            if (startswith(cmd, "#SMZERO"))
+            {
+                preferences.clear();
+                DEBUG_PRINT("Clearing preferences. ");
+                reboot();
+            }
+            else if (startswith(cmd, "#SMRESTART"))
+            {
+                reboot();
+            }
+            else if (startswith(cmd, "#SMLIST"))
+            {
+                printf("Button Actions\n");
+                printf("-----------------------------------\n");
+                MarcduinoButtonAction::listActions();
+            }
+#ifdef USE_ALLOCATION_COUNTER
+            else if (startswith(cmd, "#SMALLOC"))
+            {
+                printf("Heap Allocations In loop()\n");
+                printf("-----------------------------------\n");
+                sAllocationCounter.printStats();
+                sAllocationCounter.reset();
+            }
+#endif
+            else if (startswith(cmd, "#SMSTREAM"))
+            {
+                if (*cmd == '\0')
+                {
+                    sTelemetry.printStats();
+                }
+                else
+                {
+                    uint32_t val = strtolu(cmd, &cmd);
+                    if (val <= TELEMETRY_MAX_RATE)
+                    {
+                        setTelemetryRate(val);
+                        if (val == 0)
+                            printf("Telemetry Stream Stopped.\n");
+                        else
+                            printf("Telemetry Stream Started.\n");
+                    }
+                    else
+                    {
+                        printf("Must be in range 0-%d\n", TELEMETRY_MAX_RATE);
+                    }
+                }
+            }
+            else if (startswith(cmd, "#SMMDSTATS"))
+            {
+                printf("MarcDuino Links\n");
+                printf("-----------------------------------\n");
+                DomeMarcduino.printStats();
+#ifdef USE_BODY_MARCDUINO
+                BodyMarcduino.printStats();
+#endif
+            }
+#ifdef USE_RS485_MARCDUINO_BUS
+            else if (startswith(cmd, "#SMBUS"))
+            {
+                printf("Marcduino RS-485 Bus\n");
+                printf("-----------------------------------\n");
+                MarcduinoBus.printStats();
+            }
+#endif
+#ifdef USE_SABERTOOTH_TELEMETRY
+            else if (startswith(cmd, "#SMTELEM"))
+            {
+                printf("Foot Motor Telemetry%s\n", isFootMotorDerated ? " (DERATED)" : "");
+                printf("-----------------------------------\n");
+                FootMotorTelemetry.printStats(millis());
+            }
+#endif
+            else if (startswith(cmd, "#SMMINVOLT"))
             {
-                String key(cmd);
-                key.trim();
-                MarcduinoButtonAction* btn = MarcduinoButtonAction::findAction(key);
+                uint32_t val = strtolu(cmd, &cmd);
+                if (val == minBatteryVoltage)
+                {
+                    printf("Unchanged.\n");
+                }
+                else if (val <= 600)
+                {
+                    minBatteryVoltage = val;
+                    preferences.putInt(PREFERENCE_MIN_BATTERY_VOLTAGE, minBatteryVoltage);
+                    printf("Minimum Battery Voltage Changed.\n");
+                }
+                else
+                {
+                    printf("Must be in range 0-600\n");
+                }
+            }
+            else if (startswith(cmd, "#SMMAXCURRENT"))
+            {
+                uint32_t val = strtolu(cmd, &cmd);
+                if (val == maxMotorCurrent)
+                {
+                    printf("Unchanged.\n");
+                }
+                else if (val <= 1000)
+                {
+                    maxMotorCurrent = val;
+                    preferences.putInt(PREFERENCE_MAX_MOTOR_CURRENT, maxMotorCurrent);
+                    printf("Maximum Motor Current Changed.\n");
+                }
+                else
+                {
+                    printf("Must be in range 0-1000\n");
+                }
+            }
+            else if (startswith(cmd, "#SMDERATE"))
+            {
+                uint32_t val = strtolu(cmd, &cmd);
+                if (val == deratePercent)
+                {
+                    printf("Unchanged.\n");
+                }
+                else if (val <= 100)
+                {
+                    deratePercent = val;
+                    preferences.putInt(PREFERENCE_DERATE_PERCENT, deratePercent);
+                    printf("Derate Percent Changed.\n");
+                }
+                else
+                {
+                    printf("Must be in range 0-100\n");
+                }
+            }
+            else if (startswith(cmd, "#SMHOLDTIME"))
+            {
+                uint32_t val = strtolu(cmd, &cmd);
+                if (val == buttonHoldTime)
+                {
+                    printf("Unchanged.\n");
+                }
+                else if (val >= 100 && val <= 5000)
+                {
+                    buttonHoldTime = val;
+                    preferences.putInt(PREFERENCE_BUTTON_HOLD_TIME, buttonHoldTime);
+                    setGestureTiming();
+                    printf("Button Hold Time Changed.\n");
+                }
+                else
+                {
+                    printf("Must be in range 100-5000\n");
+                }
+            }
+            else if (startswith(cmd, "#SMDTAPTIME"))
+            {
+                uint32_t val = strtolu(cmd, &cmd);
+                if (val == buttonDoubleTapTime)
+                {
+                    printf("Unchanged.\n");
+                }
+                else if (val >= 50 && val <= 2000)
+                {
+                    buttonDoubleTapTime = val;
+                    preferences.putInt(PREFERENCE_BUTTON_DOUBLE_TAP_TIME, buttonDoubleTapTime);
+                    setGestureTiming();
+                    printf("Double Tap Time Changed.\n");
+                }
+                else
+                {
+                    printf("Must be in range 50-2000\n");
+                }
+            }
+            else if (startswith(cmd, "#SMLOOPRESET"))
+            {
+                sLoopMonitor.reset();
+                printf("Loop Statistics Reset.\n");
+            }
+            else if (startswith(cmd, "#SMLOOPBUDGET"))
+            {
+                uint32_t val = strtolu(cmd, &cmd);
+                if (val == loopBudget)
+                {
+                    printf("Unchanged.\n");
+                }
+                else if (val >= 1 && val <= 1000)
+                {
+                    loopBudget = val;
+                    preferences.putInt(PREFERENCE_LOOP_BUDGET, loopBudget);
+                    sLoopMonitor.setBudget(loopBudget);
+                    printf("Loop Budget Changed.\n");
+                }
+                else
+                {
+                    printf("Must be in range 1-1000\n");
+                }
+            }
+            else if (startswith(cmd, "#SMLOOP"))
+            {
+                printf("Control Loop\n");
+                printf("-----------------------------------\n");
+                sLoopMonitor.printStats();
+            }
+            else if (startswith(cmd, "#SMIDLETIME"))
+            {
+                uint32_t val = strtolu(cmd, &cmd);
+                if (val == idleTime)
+                {
+                    printf("Unchanged.\n");
+                }
+                else if (val <= 3600)
+                {
+                    idleTime = val;
+                    preferences.putInt(PREFERENCE_IDLE_TIME, idleTime);
+                    if (val == 0)
+                        printf("Idle Mode Disabled.\n");
+                    else
+                        printf("Idle Time Changed.\n");
+                }
+                else
+                {
+                    printf("Must be in range 0-3600\n");
+                }
+            }
+            else if (startswith(cmd, "#SMWATCHDOG"))
+            {
+                uint32_t val = strtolu(cmd, &cmd);
+                if (val == motorWatchdog)
+                {
+                    printf("Unchanged.\n");
+                }
+                else if (val == 0 || (val >= 50 && val <= 5000))
+                {
+                    motorWatchdog = val;
+                    preferences.putInt(PREFERENCE_MOTOR_WATCHDOG, motorWatchdog);
+                    sLoopMonitor.setWatchdog(motorWatchdog);
+                    if (val == 0)
+                        printf("Motor Watchdog Disabled.\n");
+                    else
+                        printf("Motor Watchdog Changed.\n");
+                }
+                else
+                {
+                    printf("Must be 0 or in range 50-5000\n");
+                }
+            }
+            else if (startswith(cmd, "#SMDEL"))
+            {
+                char* key = trimCommand(cmd);
+                ButtonGesture gesture;
+                MarcduinoButtonAction* btn = MarcduinoButtonAction::findAction(key, gesture);
                 if (btn != nullptr)
                 {
-                    btn->reset();
-                    printf("Trigger: %s reset to default %s\n", btn->name().c_str(), btn->action().c_str());
+                    btn->reset(gesture);
+                    printf("Trigger: %s reset to default %s\n", key, btn->action(gesture));
                 }
                 else
                 {
-                    printf("Trigger Not Found: %s\n", key.c_str());
+                    printf("Trigger Not Found: %s\n", key);
                 }
             }
             else if (startswith(cmd, "#SMVOLUME"))
@@ -1057,9 +2327,10 @@ void loop()
                 }
                 else
                 {
+                    soundVolume = val;
                     preferences.putInt(PREFERENCE_MARCSOUND_VOLUME, val);
                     printf("Sound Volume: %d\n", val);
-                    sMarcSound.setVolume(1000.0 / val);
+                    sMarcSound.setVolume(val / 1000.0);
                 }
             }
             else if (startswith(cmd, "#SMSOUND"))
@@ -1087,6 +2358,7 @@ void loop()
                 }
                 if (!invalid)
                 {
+                    soundPlayer = val;
                     preferences.putInt(PREFERENCE_MARCSOUND, val);
                 }
             }
@@ -1106,16 +2378,27 @@ void loop()
                 printf("Dome Auto Time:     %4d (#SMAUTOTIME)    [2000..8000]\n", time360DomeTurn);
                 printf("Marcduino Baud:   %6d (#SMMARCBAUD)\n", marcDuinoBaudRate);
                 printf("Motor Baud:       %6d (#SMMOTORBAUD)\n", motorControllerBaudRate);
+                printf("Min Battery:        %4d (#SMMINVOLT)     [0..600] 0.1V\n", minBatteryVoltage);
+                printf("Max Motor Current:  %4d (#SMMAXCURRENT)  [0..1000] 0.1A\n", maxMotorCurrent);
+                printf("Derate Percent:     %4d (#SMDERATE)      [0..100]\n", deratePercent);
+                printf("Button Hold Time:   %4d (#SMHOLDTIME)    [100..5000] ms\n", buttonHoldTime);
+                printf("Double Tap Time:    %4d (#SMDTAPTIME)    [50..2000] ms\n", buttonDoubleTapTime);
+                printf("Loop Budget:        %4d (#SMLOOPBUDGET)  [1..1000] ms\n", loopBudget);
+                printf("Motor Watchdog:     %4d (#SMWATCHDOG)    [0,50..5000] ms\n", motorWatchdog);
+                printf("Idle Time:          %4d (#SMIDLETIME)    [0..3600] s\n", idleTime);
+                printf("Loop Overruns:  %8u (#SMLOOP)\n", sLoopMonitor.overruns());
             }
             else if (startswith(cmd, "#SMSTARTUP"))
             {
                 uint32_t val = strtolu(cmd, &cmd);
+                soundStartup = val;
                 preferences.putInt(PREFERENCE_MARCSOUND_STARTUP, val);
                 printf("Startup Sound: %d\n", val);
             }
             else if (startswith(cmd, "#SMRANDMIN"))
             {
                 uint32_t val = strtolu(cmd, &cmd);
+                soundRandomMin = val;
                 preferences.putInt(PREFERENCE_MARCSOUND_RANDOM_MIN, val);
                 printf("Random Min: %d\n", val);
                 sMarcSound.setRandomMin(val);
@@ -1123,18 +2406,21 @@ void loop()
             else if (startswith(cmd, "#SMRANDMAX"))
             {
                 uint32_t val = strtolu(cmd, &cmd);
+                soundRandomMax = val;
                 preferences.putInt(PREFERENCE_MARCSOUND_RANDOM_MAX, val);
                 printf("Random Max: %d\n", val);
                 sMarcSound.setRandomMax(val);
             }
             else if (startswith(cmd, "#SMRAND0"))
             {
-                preferences.putInt(PREFERENCE_MARCSOUND_RANDOM, false);
+                soundRandom = false;
+                preferences.putBool(PREFERENCE_MARCSOUND_RANDOM, false);
                 printf("Random Disabled.\n");
                 sMarcSound.stopRandom();
             }
             else if (startswith(cmd, "#SMRAND1"))
             {
+                soundRandom = true;
                 preferences.putBool(PREFERENCE_MARCSOUND_RANDOM, true);
                 printf("Random Enabled.\n");
                 sMarcSound.startRandom();
@@ -1366,16 +2652,16 @@ void loop()
             }
             else if (startswith(cmd, "#SMPLAY"))
             {
-                String key(cmd);
-                key.trim();
-                MarcduinoButtonAction* btn = MarcduinoButtonAction::findAction(key);
+                char* key = trimCommand(cmd);
+                ButtonGesture gesture;
+                MarcduinoButtonAction* btn = MarcduinoButtonAction::findAction(key, gesture);
                 if (btn != nullptr)
                 {
-                    btn->trigger();
+                    btn->trigger(gesture);
                 }
                 else
                 {
-                    printf("Trigger Not Found: %s\n", key.c_str());
+                    printf("Trigger Not Found: %s\n", key);
                 }
             }
             else if (startswith(cmd, "#SMSET"))
@@ -1388,19 +2674,24 @@ void loop()
                 if (valp != nullptr)
                 {
                     *valp++ = '\0';
-                    String key(keyp);
-                    key.trim();
-                    MarcduinoButtonAction* btn = MarcduinoButtonAction::findAction(key);
+                    char* key = trimCommand(keyp);
+                    ButtonGesture gesture;
+                    MarcduinoButtonAction* btn = MarcduinoButtonAction::findAction(key, gesture);
                     if (btn != nullptr)
                     {
-                        String action(valp);
-                        action.trim();
-                        btn->setAction(action);
-                        printf("Trigger: %s set to %s\n", key.c_str(), action.c_str());
+                        char* action = trimCommand(valp);
+                        if (btn->setAction(action, gesture))
+                        {
+                            printf("Trigger: %s set to %s\n", key, action);
+                        }
+                        else
+                        {
+                            printf("Action too long. Max %d characters\n", MARCDUINO_ACTION_MAX_LENGTH-1);
+                        }
                     }
                     else
                     {
-                        printf("Trigger Not Found: %s\n", key.c_str());
+                        printf("Trigger Not Found: %s\n", key);
                     }
                 }
             }
@@ -1416,20 +2707,31 @@ void loop()
             sBuffer[sPos] = '\0';
         }
     }
+    sLoopMonitor.mark(ControlLoopMonitor::kConsole);
 
-    // Clear inbound buffer of any data sent from the MarcDuino board
-    if (MD_SERIAL.available())
+    // Parse replies from the MarcDuino boards and send the queued commands they are ready for
+    uint32_t marcduinoNow = millis();
+#ifndef USE_RS485_MARCDUINO_BUS
+    while (MD_SERIAL.available())
     {
-        int ch = MD_SERIAL.read();
-        Serial.print((char)ch);
+        DomeMarcduino.receive(MD_SERIAL.read(), marcduinoNow);
     }
-#if defined(ENABLE_BODY_MD_SERIAL)
-    if (BODY_MD_SERIAL.available())
+#ifdef ENABLE_BODY_MD_SERIAL
+    while (BODY_MD_SERIAL.available())
     {
-        int ch = BODY_MD_SERIAL.read();
-        Serial.print((char)ch);
+        BodyMarcduino.receive(BODY_MD_SERIAL.read(), marcduinoNow);
     }
 #endif
+#endif
+    DomeMarcduino.task(marcduinoNow);
+#ifdef USE_BODY_MARCDUINO
+    BodyMarcduino.task(marcduinoNow);
+#endif
+#ifdef USE_RS485_MARCDUINO_BUS
+    // Send the frames queued during this pass in one transmit window and parse replies
+    MarcduinoBus.task(marcduinoNow);
+#endif
+    sLoopMonitor.mark(ControlLoopMonitor::kMarcduinoSerial);
 }
 
 // =======================================================================================
@@ -1455,7 +2757,7 @@ bool ps3FootMotorDrive(PS3BT* myPS3 = PS3NavFoot)
 
             if (!isFootMotorStopped)
             {
-                FootMotor->stop();
+                FootMotor.stop();
                 isFootMotorStopped = true;
                 footDriveSpeed = 0;
               
@@ -1467,7 +2769,7 @@ bool ps3FootMotorDrive(PS3BT* myPS3 = PS3NavFoot)
         {
             if (!isFootMotorStopped)
             {
-                FootMotor->stop();
+                FootMotor.stop();
                 isFootMotorStopped = true;
                 footDriveSpeed = 0;
 
@@ -1480,7 +2782,7 @@ bool ps3FootMotorDrive(PS3BT* myPS3 = PS3NavFoot)
         {
             if (!isFootMotorStopped)
             {
-                FootMotor->stop();
+                FootMotor.stop();
                 isFootMotorStopped = true;
                 footDriveSpeed = 0;
 
@@ -1581,6 +2883,7 @@ bool ps3FootMotorDrive(PS3BT* myPS3 = PS3NavFoot)
             {
                 isFootMotorStopped = false;   
             }
+            footTurnSpeed = turnnum;
 
             currentMillis = millis();
           
@@ -1589,14 +2892,14 @@ bool ps3FootMotorDrive(PS3BT* myPS3 = PS3NavFoot)
                 if (footDriveSpeed != 0 || abs(turnnum) > 5)
                 {
                     SHADOW_VERBOSE("Motor: FootSpeed: %d\nTurnnum: %d\nTime of command: %lu\n", footDriveSpeed, turnnum, millis())              
-                    FootMotor->turn(turnnum * (invertTurnDirection ? 1 : -1));
-                    FootMotor->drive(footDriveSpeed);
+                    FootMotor.turn(derateFootSpeed(turnnum) * (invertTurnDirection ? 1 : -1));
+                    FootMotor.drive(derateFootSpeed(footDriveSpeed));
                 }
                 else
                 {    
                     if (!isFootMotorStopped)
                     {
-                        FootMotor->stop();
+                        FootMotor.stop();
                         isFootMotorStopped = true;
                         footDriveSpeed = 0;
                       
@@ -1616,6 +2919,64 @@ bool ps3FootMotorDrive(PS3BT* myPS3 = PS3NavFoot)
     return false;
 }
 
+// =======================================================================================
+//           Motor controller telemetry and speed derating
+// =======================================================================================
+
+////////////////////////////////
+// Milliseconds until the next motor command may be sent on MOTOR_SERIAL
+long motorBusIdleTime()
+{
+    long now = millis();
+    long idle = 1000;
+    if (!isFootMotorStopped)
+        idle = min(idle, previousFootMillis + serialLatency - now);
+#ifndef USE_PWM_DOME_MOTOR_DRIVER
+    if (!isDomeMotorStopped)
+        idle = min(idle, previousDomeMillis + 2*serialLatency - now);
+#endif
+    return max(idle, 0L);
+}
+
+#ifdef USE_SABERTOOTH_TELEMETRY
+void motorTelemetry()
+{
+    FootMotorTelemetry.task(millis(), motorBusIdleTime());
+}
+#endif
+
+////////////////////////////////
+// Scale foot drive and turn speed down while the battery is low or the motors draw too much current
+int derateFootSpeed(int speed)
+{
+#ifdef USE_SABERTOOTH_TELEMETRY
+    uint32_t now = millis();
+    bool derate = false;
+    if (minBatteryVoltage != 0 &&
+        FootMotorTelemetry.valid(SabertoothTelemetry::kBattery, now, TELEMETRY_MAX_AGE) &&
+        FootMotorTelemetry.value(SabertoothTelemetry::kBattery) < minBatteryVoltage)
+    {
+        derate = true;
+    }
+    if (maxMotorCurrent != 0 &&
+        ((FootMotorTelemetry.valid(SabertoothTelemetry::kCurrent1, now, TELEMETRY_MAX_AGE) &&
+          abs(FootMotorTelemetry.value(SabertoothTelemetry::kCurrent1)) > maxMotorCurrent) ||
+         (FootMotorTelemetry.valid(SabertoothTelemetry::kCurrent2, now, TELEMETRY_MAX_AGE) &&
+          abs(FootMotorTelemetry.value(SabertoothTelemetry::kCurrent2)) > maxMotorCurrent)))
+    {
+        derate = true;
+    }
+    if (derate != isFootMotorDerated)
+    {
+        isFootMotorDerated = derate;
+        SHADOW_DEBUG("Foot Motor Derating %s\n", derate ? "ON" : "OFF")
+    }
+    if (derate)
+        speed = speed * deratePercent / 100;
+#endif
+    return speed;
+}
+
 void footMotorDrive()
 {
     //Flood control prevention
@@ -1651,7 +3012,7 @@ int ps3DomeDrive(PS3BT* myPS3 = PS3NavDome)
     return domeRotationSpeed;
 }
 
-void rotateDome(int domeRotationSpeed, String mesg)
+void rotateDome(int domeRotationSpeed, const char* mesg)
 {
     //Constantly sending commands to the SyRen (Dome) is causing foot motor delay.
     //Lets reduce that chatter by trying 3 things:
@@ -1666,21 +3027,36 @@ void rotateDome(int domeRotationSpeed, String mesg)
     {
         if (domeRotationSpeed != 0)
         {
-            isDomeMotorStopped = false;
             SHADOW_VERBOSE("Dome rotation speed: %d\n", domeRotationSpeed)        
-            DomeMotor->motor(domeRotationSpeed);
         }
         else
         {
-            isDomeMotorStopped = true; 
             SHADOW_VERBOSE("\n***Dome motor is STOPPED***\n")
-            
-            DomeMotor->stop();
         }
+        setDomeMotor(domeRotationSpeed);
         previousDomeMillis = currentMillis;      
     }
 }
 
+// Dome motor commands from the controllers and the stop paths go through here so
+// isDomeMotorStopped and domeSpeedSetpoint match what the motor was last told.
+// autoDome() drives the motor itself and only updates domeSpeedSetpoint: with
+// isDomeMotorStopped clear a centred dome stick would stop its turn in rotateDome().
+void setDomeMotor(int domeRotationSpeed)
+{
+    if (domeRotationSpeed != 0)
+    {
+        DomeMotor.motor(domeRotationSpeed);
+        isDomeMotorStopped = false;
+    }
+    else
+    {
+        DomeMotor.stop();
+        isDomeMotorStopped = true;
+    }
+    domeSpeedSetpoint = domeRotationSpeed;
+}
+
 void domeDrive()
 {
     //Flood control prevention
@@ -1706,8 +3082,7 @@ void domeDrive()
     }
     else if (!isDomeMotorStopped)
     {
-        DomeMotor->stop();
-        isDomeMotorStopped = true;
+        setDomeMotor(0);
     }  
 }  
 
@@ -1723,7 +3098,7 @@ void ps3ToggleSettings(PS3BT* myPS3 = PS3NavFoot)
         SHADOW_DEBUG("Disabling the DriveStick\n")
         SHADOW_DEBUG("Stopping Motors\n")
 
-        FootMotor->stop();
+        FootMotor.stop();
         isFootMotorStopped = true;
         isStickEnabled = false;
         footDriveSpeed = 0;
@@ -1736,27 +3111,17 @@ void ps3ToggleSettings(PS3BT* myPS3 = PS3NavFoot)
     }
     
     // Enable and Disable Overspeed
-    if (myPS3->getButtonPress(L3) && myPS3->getButtonPress(L1) && isStickEnabled)
+    if (sFootButtons.comboPressed(BUTTON_BIT(L3) | BUTTON_BIT(L1)) && isStickEnabled)
     {
-        if ((millis() - previousSpeedToggleMillis) > 1000)
+        if (!overSpeedSelected)
         {
-            speedToggleButtonCounter = 0;
-            previousSpeedToggleMillis = millis();
-        } 
-
-        speedToggleButtonCounter += 1;       
-        if (speedToggleButtonCounter == 1)
-        {
-            if (!overSpeedSelected)
-            {
-                overSpeedSelected = true;
-                SHADOW_VERBOSE("Over Speed is now: ON\n");
-            }
-            else
-            {      
-                overSpeedSelected = false;
-                SHADOW_VERBOSE("Over Speed is now: OFF\n")
-            }
+            overSpeedSelected = true;
+            SHADOW_VERBOSE("Over Speed is now: ON\n");
+        }
+        else
+        {      
+            overSpeedSelected = false;
+            SHADOW_VERBOSE("Over Speed is now: OFF\n")
         }
     }
    
@@ -1766,8 +3131,7 @@ void ps3ToggleSettings(PS3BT* myPS3 = PS3NavFoot)
         domeAutomation = false;
         domeStatus = 0;
         domeTargetPosition = 0;
-        DomeMotor->stop();
-        isDomeMotorStopped = true;
+        setDomeMotor(0);
         
         SHADOW_DEBUG("Dome Automation OFF\n")
     } 
@@ -1787,340 +3151,155 @@ void toggleSettings()
 }  
 
 // ====================================================================================================================
-// This function determines if MarcDuino buttons were selected and calls main processing function for FOOT controller
+// Button gesture engine. Each loop the button bitmask of both controllers is compared with the previous loop.
+// The press edge of an arrow button resolves the button combo (arrow + modifiers) and the gesture trackers
+// turn press/release timing into tap, hold and double-tap triggers.
 // ====================================================================================================================
-void marcDuinoFoot()
+#define ARROW_BUTTONS (BUTTON_BIT(UP) | BUTTON_BIT(DOWN) | BUTTON_BIT(LEFT) | BUTTON_BIT(RIGHT))
+
+struct ArrowActions
 {
-    if (PS3NavFoot->PS3NavigationConnected && (PS3NavFoot->getButtonPress(UP) || PS3NavFoot->getButtonPress(DOWN) || PS3NavFoot->getButtonPress(LEFT) || PS3NavFoot->getButtonPress(RIGHT)))
-    {
-        if ((millis() - previousMarcDuinoMillis) > 1000)
-        {
-            marcDuinoButtonCounter = 0;
-            previousMarcDuinoMillis = millis();
-        }
-       marcDuinoButtonCounter += 1;
-    }
-    else
-    {
-        return;    
-    }
-   
-    //------------------------------------ 
-    // Send triggers for the base buttons 
-    //------------------------------------
-    if (PS3NavFoot->getButtonPress(UP) && !PS3NavFoot->getButtonPress(CROSS) && !PS3NavFoot->getButtonPress(CIRCLE) && !PS3NavFoot->getButtonPress(L1) && !PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        if (PS3NavDome->PS3NavigationConnected && (PS3NavDome->getButtonPress(CROSS) || PS3NavDome->getButtonPress(CIRCLE) || PS3NavDome->getButtonPress(PS)))
-        {
-            // Skip this section
-        }
-        else
-        {
-            btnUP_MD.trigger();
-            return;
-        }
-    }
-    
-    if (PS3NavFoot->getButtonPress(DOWN) && !PS3NavFoot->getButtonPress(CROSS) && !PS3NavFoot->getButtonPress(CIRCLE) && !PS3NavFoot->getButtonPress(L1) && !PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        if (PS3NavDome->PS3NavigationConnected && (PS3NavDome->getButtonPress(CROSS) || PS3NavDome->getButtonPress(CIRCLE) || PS3NavDome->getButtonPress(PS)))
-        {
-            // Skip this section
-        }
-        else
-        {     
-            btnDown_MD.trigger();
-            return;
-        }
-    }
-    
-    if (PS3NavFoot->getButtonPress(LEFT) && !PS3NavFoot->getButtonPress(CROSS) && !PS3NavFoot->getButtonPress(CIRCLE) && !PS3NavFoot->getButtonPress(L1) && !PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        if (PS3NavDome->PS3NavigationConnected && (PS3NavDome->getButtonPress(CROSS) || PS3NavDome->getButtonPress(CIRCLE) || PS3NavDome->getButtonPress(PS)))
-        {
-            // Skip this section
-        }
-        else
-        {           
-            btnLeft_MD.trigger();
-            return;
-        }
-    }
+    uint32_t fArrow;
+    MarcduinoButtonAction* fBase;
+    MarcduinoButtonAction* fCross;
+    MarcduinoButtonAction* fCircle;
+    MarcduinoButtonAction* fL1;
+    MarcduinoButtonAction* fPS;
+};
+
+// In order of priority when more than one arrow is pressed in the same loop
+static const ArrowActions sFootArrowActions[] = {
+    { BUTTON_BIT(UP),    &btnUP_MD,    &btnUP_CROSS_MD,    &btnUP_CIRCLE_MD,    &btnUP_L1_MD,    &btnUP_PS_MD },
+    { BUTTON_BIT(DOWN),  &btnDown_MD,  &btnDown_CROSS_MD,  &btnDown_CIRCLE_MD,  &btnDown_L1_MD,  &btnDown_PS_MD },
+    { BUTTON_BIT(LEFT),  &btnLeft_MD,  &btnLeft_CROSS_MD,  &btnLeft_CIRCLE_MD,  &btnLeft_L1_MD,  &btnLeft_PS_MD },
+    { BUTTON_BIT(RIGHT), &btnRight_MD, &btnRight_CROSS_MD, &btnRight_CIRCLE_MD, &btnRight_L1_MD, &btnRight_PS_MD }
+};
 
-    if (PS3NavFoot->getButtonPress(RIGHT) && !PS3NavFoot->getButtonPress(CROSS) && !PS3NavFoot->getButtonPress(CIRCLE) && !PS3NavFoot->getButtonPress(L1) && !PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
+static const ArrowActions sDomeArrowActions[] = {
+    { BUTTON_BIT(UP),    &FTbtnUP_MD,    &FTbtnUP_CROSS_MD,    &FTbtnUP_CIRCLE_MD,    &FTbtnUP_L1_MD,    &FTbtnUP_PS_MD },
+    { BUTTON_BIT(DOWN),  &FTbtnDown_MD,  &FTbtnDown_CROSS_MD,  &FTbtnDown_CIRCLE_MD,  &FTbtnDown_L1_MD,  &FTbtnDown_PS_MD },
+    { BUTTON_BIT(LEFT),  &FTbtnLeft_MD,  &FTbtnLeft_CROSS_MD,  &FTbtnLeft_CIRCLE_MD,  &FTbtnLeft_L1_MD,  &FTbtnLeft_PS_MD },
+    { BUTTON_BIT(RIGHT), &FTbtnRight_MD, &FTbtnRight_CROSS_MD, &FTbtnRight_CIRCLE_MD, &FTbtnRight_L1_MD, &FTbtnRight_PS_MD }
+};
+
+ButtonGestureTracker<MarcduinoButtonAction> sFootGestures;
+ButtonGestureTracker<MarcduinoButtonAction> sDomeGestures;
+
+uint32_t ps3ButtonMask(PS3BT* myPS3)
+{
+    static const ButtonEnum sButtons[] = { UP, DOWN, LEFT, RIGHT, CROSS, CIRCLE, L1, L2, L3, PS };
+    uint32_t mask = 0;
+    if (myPS3->PS3NavigationConnected)
     {
-        if (PS3NavDome->PS3NavigationConnected && (PS3NavDome->getButtonPress(CROSS) || PS3NavDome->getButtonPress(CIRCLE) || PS3NavDome->getButtonPress(PS)))
+        for (unsigned i = 0; i < SizeOfArray(sButtons); i++)
         {
-            // Skip this section
+            if (myPS3->getButtonPress(sButtons[i]))
+                mask |= BUTTON_BIT(sButtons[i]);
         }
-        else
-        {     
-            btnRight_MD.trigger();;
-            return;
-        }
-    }
-    
-    //------------------------------------ 
-    // Send triggers for the CROSS + base buttons 
-    //------------------------------------
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(UP) && PS3NavFoot->getButtonPress(CROSS)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(UP) && PS3NavDome->getButtonPress(CROSS))) && marcDuinoButtonCounter == 1)
-    {
-        btnUP_CROSS_MD.trigger();
-        return;        
-    }
-    
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(DOWN) && PS3NavFoot->getButtonPress(CROSS)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(DOWN) && PS3NavDome->getButtonPress(CROSS))) && marcDuinoButtonCounter == 1)
-    {      
-        btnDown_CROSS_MD.trigger();
-        return;
-    }
-    
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(LEFT) && PS3NavFoot->getButtonPress(CROSS)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(LEFT) && PS3NavDome->getButtonPress(CROSS))) && marcDuinoButtonCounter == 1)
-    {
-        btnLeft_CROSS_MD.trigger();;
-        return;
     }
+    return mask;
+}
 
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(RIGHT) && PS3NavFoot->getButtonPress(CROSS)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(RIGHT) && PS3NavDome->getButtonPress(CROSS))) && marcDuinoButtonCounter == 1)
-    {
-        btnRight_CROSS_MD.trigger();
-        return;
-    }
+////////////////////////////////
+// Sample both controllers once per loop so every consumer sees the same edges
+void readButtons()
+{
+    sFootButtons.update(ps3ButtonMask(PS3NavFoot));
+    sDomeButtons.update(ps3ButtonMask(PS3NavDome));
+}
 
-    //------------------------------------ 
-    // Send triggers for the CIRCLE + base buttons 
-    //------------------------------------
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(UP) && PS3NavFoot->getButtonPress(CIRCLE)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(UP) && PS3NavDome->getButtonPress(CIRCLE))) && marcDuinoButtonCounter == 1)
-    {
-        btnUP_CIRCLE_MD.trigger();
-        return;
-    }
-    
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(DOWN) && PS3NavFoot->getButtonPress(CIRCLE)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(DOWN) && PS3NavDome->getButtonPress(CIRCLE))) && marcDuinoButtonCounter == 1)
-    {
-        btnDown_CIRCLE_MD.trigger();
-        return;
-    }
-    
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(LEFT) && PS3NavFoot->getButtonPress(CIRCLE)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(LEFT) && PS3NavDome->getButtonPress(CIRCLE))) && marcDuinoButtonCounter == 1)
-    {
-        btnLeft_CIRCLE_MD.trigger();
-        return;
-    }
+void setGestureTiming()
+{
+    sFootGestures.setTiming(buttonHoldTime, buttonDoubleTapTime);
+    sDomeGestures.setTiming(buttonHoldTime, buttonDoubleTapTime);
+}
 
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(RIGHT) && PS3NavFoot->getButtonPress(CIRCLE)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(RIGHT) && PS3NavDome->getButtonPress(CIRCLE))) && marcDuinoButtonCounter == 1)
-    {
-        btnRight_CIRCLE_MD.trigger();
-        return;
-    }
-    
-    //------------------------------------ 
-    // Send triggers for the L1 + base buttons 
-    //------------------------------------
-    if (PS3NavFoot->getButtonPress(UP) && PS3NavFoot->getButtonPress(L1) && marcDuinoButtonCounter == 1)
-    {
-        btnUP_L1_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavFoot->getButtonPress(DOWN) && PS3NavFoot->getButtonPress(L1) && marcDuinoButtonCounter == 1)
-    {
-        btnDown_L1_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavFoot->getButtonPress(LEFT) && PS3NavFoot->getButtonPress(L1) && marcDuinoButtonCounter == 1)
-    {
-        btnLeft_L1_MD.trigger();
-        return;
-    }
+// ====================================================================================================================
+// This function determines if MarcDuino buttons were selected and calls main processing function for FOOT controller
+// ====================================================================================================================
+MarcduinoButtonAction* resolveFootAction(const ArrowActions &arrow)
+{
+    uint32_t foot = sFootButtons.current();
+    uint32_t dome = sDomeButtons.current();
+    bool domeConnected = PS3NavDome->PS3NavigationConnected;
+    // With a dome controller connected CROSS, CIRCLE and PS modifiers come from the dome controller
+    uint32_t modifiers = (domeConnected) ? dome : foot;
+
+    if (!(foot & (BUTTON_BIT(CROSS) | BUTTON_BIT(CIRCLE) | BUTTON_BIT(L1) | BUTTON_BIT(PS))) &&
+        !(domeConnected && (dome & (BUTTON_BIT(CROSS) | BUTTON_BIT(CIRCLE) | BUTTON_BIT(PS)))))
+    {
+        return arrow.fBase;
+    }
+    if (modifiers & BUTTON_BIT(CROSS))
+        return arrow.fCross;
+    if (modifiers & BUTTON_BIT(CIRCLE))
+        return arrow.fCircle;
+    if (foot & BUTTON_BIT(L1))
+        return arrow.fL1;
+    if (modifiers & BUTTON_BIT(PS))
+        return arrow.fPS;
+    return nullptr;
+}
 
-    if (PS3NavFoot->getButtonPress(RIGHT) && PS3NavFoot->getButtonPress(L1) && marcDuinoButtonCounter == 1)
-    {
-        btnRight_L1_MD.trigger();
-        return;
-    }
-    
-    //------------------------------------ 
-    // Send triggers for the PS + base buttons 
-    //------------------------------------
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(UP) && PS3NavFoot->getButtonPress(PS)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(UP) && PS3NavDome->getButtonPress(PS))) && marcDuinoButtonCounter == 1)
-    {
-        btnUP_PS_MD.trigger();
-        return;
-    }
-    
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(DOWN) && PS3NavFoot->getButtonPress(PS)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(DOWN) && PS3NavDome->getButtonPress(PS))) && marcDuinoButtonCounter == 1)
-    {
-        btnDown_PS_MD.trigger();
-        return;
-    }
-    
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(LEFT) && PS3NavFoot->getButtonPress(PS)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(LEFT) && PS3NavDome->getButtonPress(PS))) && marcDuinoButtonCounter == 1)
-    {
-        btnLeft_PS_MD.trigger();
-        return;
-    }
+void marcDuinoFoot()
+{
+    uint32_t now = millis();
+    sFootGestures.update(sFootButtons, now);
 
-    if (((!PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(RIGHT) && PS3NavFoot->getButtonPress(PS)) || (PS3NavDome->PS3NavigationConnected && PS3NavFoot->getButtonPress(RIGHT) && PS3NavDome->getButtonPress(PS))) && marcDuinoButtonCounter == 1)
-    {
-        btnRight_PS_MD.trigger();
+    uint32_t pressed = sFootButtons.pressed() & ARROW_BUTTONS;
+    if (pressed == 0)
         return;
+    for (unsigned i = 0; i < SizeOfArray(sFootArrowActions); i++)
+    {
+        const ArrowActions &arrow = sFootArrowActions[i];
+        if (pressed & arrow.fArrow)
+        {
+            sFootGestures.press(arrow.fArrow, resolveFootAction(arrow), now);
+            return;
+        }
     }
 }
 
 // ===================================================================================================================
 // This function determines if MarcDuino buttons were selected and calls main processing function for DOME Controller
 // ===================================================================================================================
-void marcDuinoDome()
+MarcduinoButtonAction* resolveDomeAction(const ArrowActions &arrow)
 {
-    if (PS3NavDome->PS3NavigationConnected && (PS3NavDome->getButtonPress(UP) || PS3NavDome->getButtonPress(DOWN) || PS3NavDome->getButtonPress(LEFT) || PS3NavDome->getButtonPress(RIGHT)))
-    {
-        if ((millis() - previousMarcDuinoMillis) > 1000)
-        {
-            marcDuinoButtonCounter = 0;
-            previousMarcDuinoMillis = millis();
-        }
-        marcDuinoButtonCounter += 1;
-    }
-    else
-    {
-        return;    
-    }
-
-    //------------------------------------ 
-    // Send triggers for the base buttons 
-    //------------------------------------
-    if (PS3NavDome->getButtonPress(UP) && !PS3NavDome->getButtonPress(CROSS) && !PS3NavDome->getButtonPress(CIRCLE) && !PS3NavDome->getButtonPress(L1) && !PS3NavDome->getButtonPress(PS) && !PS3NavFoot->getButtonPress(CROSS) && !PS3NavFoot->getButtonPress(CIRCLE) && !PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnUP_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(DOWN) && !PS3NavDome->getButtonPress(CROSS) && !PS3NavDome->getButtonPress(CIRCLE) && !PS3NavDome->getButtonPress(L1) && !PS3NavDome->getButtonPress(PS) && !PS3NavFoot->getButtonPress(CROSS) && !PS3NavFoot->getButtonPress(CIRCLE) && !PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnDown_MD.trigger();
-        return;      
-    }
-    
-    if (PS3NavDome->getButtonPress(LEFT) && !PS3NavDome->getButtonPress(CROSS) && !PS3NavDome->getButtonPress(CIRCLE) && !PS3NavDome->getButtonPress(L1) && !PS3NavDome->getButtonPress(PS) && !PS3NavFoot->getButtonPress(CROSS) && !PS3NavFoot->getButtonPress(CIRCLE) && !PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnLeft_MD.trigger();
-        return;
-    }
-
-    if (PS3NavDome->getButtonPress(RIGHT) && !PS3NavDome->getButtonPress(CROSS) && !PS3NavDome->getButtonPress(CIRCLE) && !PS3NavDome->getButtonPress(L1) && !PS3NavDome->getButtonPress(PS) && !PS3NavFoot->getButtonPress(CROSS) && !PS3NavFoot->getButtonPress(CIRCLE) && !PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnRight_MD.trigger();
-        return;
-    }
-    
-    //------------------------------------ 
-    // Send triggers for the CROSS + base buttons 
-    //------------------------------------
-    if (PS3NavDome->getButtonPress(UP) && PS3NavFoot->getButtonPress(CROSS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnUP_CROSS_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(DOWN) && PS3NavFoot->getButtonPress(CROSS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnDown_CROSS_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(LEFT) && PS3NavFoot->getButtonPress(CROSS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnLeft_CROSS_MD.trigger();
-        return;
-    }
-
-    if (PS3NavDome->getButtonPress(RIGHT) && PS3NavFoot->getButtonPress(CROSS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnRight_CROSS_MD.trigger();
-        return;
-    }
-
-    //------------------------------------ 
-    // Send triggers for the CIRCLE + base buttons 
-    //------------------------------------
-    if (PS3NavDome->getButtonPress(UP) && PS3NavFoot->getButtonPress(CIRCLE) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnUP_CIRCLE_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(DOWN) && PS3NavFoot->getButtonPress(CIRCLE) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnDown_CIRCLE_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(LEFT) && PS3NavFoot->getButtonPress(CIRCLE) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnLeft_CIRCLE_MD.trigger();
-        return;
-    }
+    uint32_t foot = sFootButtons.current();
+    uint32_t dome = sDomeButtons.current();
+
+    if (!(dome & (BUTTON_BIT(CROSS) | BUTTON_BIT(CIRCLE) | BUTTON_BIT(L1) | BUTTON_BIT(PS))) &&
+        !(foot & (BUTTON_BIT(CROSS) | BUTTON_BIT(CIRCLE) | BUTTON_BIT(PS))))
+    {
+        return arrow.fBase;
+    }
+    if (foot & BUTTON_BIT(CROSS))
+        return arrow.fCross;
+    if (foot & BUTTON_BIT(CIRCLE))
+        return arrow.fCircle;
+    if (dome & BUTTON_BIT(L1))
+        return arrow.fL1;
+    if (foot & BUTTON_BIT(PS))
+        return arrow.fPS;
+    return nullptr;
+}
 
-    if (PS3NavDome->getButtonPress(RIGHT) && PS3NavFoot->getButtonPress(CIRCLE) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnRight_CIRCLE_MD.trigger();
-        return;
-    }
-    
-    //------------------------------------ 
-    // Send triggers for the L1 + base buttons 
-    //------------------------------------
-    if (PS3NavDome->getButtonPress(UP) && PS3NavDome->getButtonPress(L1) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnUP_L1_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(DOWN) && PS3NavDome->getButtonPress(L1) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnDown_L1_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(LEFT) && PS3NavDome->getButtonPress(L1) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnLeft_L1_MD.trigger();
-        return;
-    }
+void marcDuinoDome()
+{
+    uint32_t now = millis();
+    sDomeGestures.update(sDomeButtons, now);
 
-    if (PS3NavDome->getButtonPress(RIGHT) && PS3NavDome->getButtonPress(L1) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnRight_L1_MD.trigger();
-        return;
-    }
-    
-    //------------------------------------ 
-    // Send triggers for the PS + base buttons 
-    //------------------------------------
-    if (PS3NavDome->getButtonPress(UP) && PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnUP_PS_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(DOWN) && PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnDown_PS_MD.trigger();
-        return;
-    }
-    
-    if (PS3NavDome->getButtonPress(LEFT) && PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
-    {
-        FTbtnLeft_PS_MD.trigger();
+    uint32_t pressed = sDomeButtons.pressed() & ARROW_BUTTONS;
+    if (pressed == 0)
         return;
-    }
-
-    if (PS3NavDome->getButtonPress(RIGHT) && PS3NavFoot->getButtonPress(PS) && marcDuinoButtonCounter == 1)
+    for (unsigned i = 0; i < SizeOfArray(sDomeArrowActions); i++)
     {
-        FTbtnRight_PS_MD.trigger();
-        return;
+        const ArrowActions &arrow = sDomeArrowActions[i];
+        if (pressed & arrow.fArrow)
+        {
+            sDomeGestures.press(arrow.fArrow, resolveDomeAction(arrow), now);
+            return;
+        }
     }
 }
 
@@ -2239,14 +3418,16 @@ void autoDome()
         if (domeStopTurnTime > millis())
         {
             domeSpeed = domeAutoSpeed * domeTurnDirection;
-            DomeMotor->motor(domeSpeed);
+            DomeMotor.motor(domeSpeed);
+            domeSpeedSetpoint = domeSpeed;
 
             SHADOW_DEBUG("Turning Now!!\n")
         }
         else  // turn completed - stop the motor
         {
             domeStatus = 0;
-            DomeMotor->stop();
+            DomeMotor.stop();
+            domeSpeedSetpoint = 0;
 
             SHADOW_DEBUG("STOP TURN!!\n")
         }      
@@ -2259,14 +3440,14 @@ void autoDome()
 
 void onInitPS3NavFoot()
 {
-    String btAddress = getLastConnectedBtMAC();
+    const char* btAddress = getLastConnectedBtMAC();
     PS3NavFoot->setLedOn(LED1);
     isPS3NavigatonInitialized = true;
     badPS3Data = 0;
 
-    SHADOW_DEBUG("\nBT Address of Last connected Device when FOOT PS3 Connected: %s\n", btAddress.c_str());
+    SHADOW_DEBUG("\nBT Address of Last connected Device when FOOT PS3 Connected: %s\n", btAddress);
     
-    if (btAddress == PS3ControllerFootMac || btAddress == PS3ControllerBackupFootMac)
+    if (strcmp(btAddress, PS3ControllerFootMac) == 0 || strcmp(btAddress, PS3ControllerBackupFootMac) == 0)
     {
         SHADOW_DEBUG("\nWe have our FOOT controller connected.\n")
           
@@ -2276,10 +3457,10 @@ void onInitPS3NavFoot()
 #ifdef USE_PREFERENCES
     else if (PS3ControllerFootMac[0] == 'X')
     {
-        SHADOW_DEBUG("\nAssigning %s as FOOT controller.\n", btAddress.c_str());
+        SHADOW_DEBUG("\nAssigning %s as FOOT controller.\n", btAddress);
           
         preferences.putString(PREFERENCE_PS3_FOOT_MAC, btAddress);
-        PS3ControllerFootMac = btAddress;
+        snprintf(PS3ControllerFootMac, sizeof(PS3ControllerFootMac), "%s", btAddress);
         mainControllerConnected = true;
         WaitingforReconnect = true;
     }
@@ -2289,8 +3470,8 @@ void onInitPS3NavFoot()
         // Prevent connection from anything but the MAIN controllers          
         SHADOW_DEBUG("\nWe have an invalid controller trying to connect as tha FOOT controller, it will be dropped.\n")
 
-        FootMotor->stop();
-        DomeMotor->stop();
+        FootMotor.stop();
+        setDomeMotor(0);
         isFootMotorStopped = true;
         footDriveSpeed = 0;
         PS3NavFoot->setLedOff(LED1);
@@ -2303,12 +3484,12 @@ void onInitPS3NavFoot()
 
 void onInitPS3NavDome()
 {
-    String btAddress = getLastConnectedBtMAC();
+    const char* btAddress = getLastConnectedBtMAC();
     PS3NavDome->setLedOn(LED1);
     isSecondaryPS3NavigatonInitialized = true;
     badPS3Data = 0;
     
-    if (btAddress == PS3ControllerDomeMAC || btAddress == PS3ControllerBackupDomeMAC)
+    if (strcmp(btAddress, PS3ControllerDomeMAC) == 0 || strcmp(btAddress, PS3ControllerBackupDomeMAC) == 0)
     {
         SHADOW_DEBUG("\nWe have our DOME controller connected.\n")
           
@@ -2318,10 +3499,10 @@ void onInitPS3NavDome()
 #ifdef USE_PREFERENCES
     else if (PS3ControllerDomeMAC[0] == 'X')
     {
-        SHADOW_DEBUG("\nAssigning %s as DOME controller.\n", btAddress.c_str());
+        SHADOW_DEBUG("\nAssigning %s as DOME controller.\n", btAddress);
           
         preferences.putString(PREFERENCE_PS3_DOME_MAC, btAddress);
-        PS3ControllerDomeMAC = btAddress;
+        snprintf(PS3ControllerDomeMAC, sizeof(PS3ControllerDomeMAC), "%s", btAddress);
 
         domeControllerConnected = true;
         WaitingforReconnectDome = true;
@@ -2332,8 +3513,8 @@ void onInitPS3NavDome()
         // Prevent connection from anything but the DOME controllers          
         SHADOW_DEBUG("\nWe have an invalid controller trying to connect as the DOME controller, it will be dropped.\n")
 
-        FootMotor->stop();
-        DomeMotor->stop();
+        FootMotor.stop();
+        setDomeMotor(0);
         isFootMotorStopped = true;
         footDriveSpeed = 0;
         PS3NavDome->setLedOff(LED1);
@@ -2344,13 +3525,13 @@ void onInitPS3NavDome()
     } 
 }
 
-String getLastConnectedBtMAC()
+const char* getLastConnectedBtMAC()
 {
-    char buffer[20];
+    static char sBuffer[20];
     uint8_t* addr = Btd.disc_bdaddr;
-    snprintf(buffer, sizeof(buffer), "%02X:%02X:%02X:%02X:%02X:%02X",
+    snprintf(sBuffer, sizeof(sBuffer), "%02X:%02X:%02X:%02X:%02X:%02X",
         addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
-    return buffer;
+    return sBuffer;
 }
 
 bool criticalFaultDetect()
@@ -2383,7 +3564,7 @@ bool criticalFaultDetect()
         {
             SHADOW_DEBUG("It has been 300ms since we heard from the PS3 Foot Controller\n")
             SHADOW_DEBUG("Shutting down motors, and watching for a new PS3 Foot message\n")
-            FootMotor->stop();
+            FootMotor.stop();
             isFootMotorStopped = true;
             footDriveSpeed = 0;
         }
@@ -2393,7 +3574,7 @@ bool criticalFaultDetect()
             SHADOW_DEBUG("It has been 10s since we heard from the PS3 Foot Controller\nmsgLagTime:%u  lastMsgTime:%u  millis: %lu\n",
                           msgLagTime, lastMsgTime, millis())
             SHADOW_DEBUG("Disconnecting the Foot controller\n")
-            FootMotor->stop();
+            FootMotor.stop();
             isFootMotorStopped = true;
             footDriveSpeed = 0;
             PS3NavFoot->disconnect();
@@ -2435,7 +3616,7 @@ bool criticalFaultDetect()
             SHADOW_DEBUG("Too much bad data coming from the PS3 FOOT Controller\n")
             SHADOW_DEBUG("Disconnecting the controller and stop motors.\n")
 
-            FootMotor->stop();
+            FootMotor.stop();
             isFootMotorStopped = true;
             footDriveSpeed = 0;
             PS3NavFoot->disconnect();
@@ -2448,7 +3629,7 @@ bool criticalFaultDetect()
         SHADOW_DEBUG("No foot controller was found\n")
         SHADOW_DEBUG("Shuting down motors and watching for a new PS3 foot message\n")
 
-        FootMotor->stop();
+        FootMotor.stop();
         isFootMotorStopped = true;
         footDriveSpeed = 0;
         WaitingforReconnect = true;
@@ -2491,7 +3672,7 @@ bool criticalFaultDetectDome()
                           msgLagTime, lastMsgTime, millis())
             SHADOW_DEBUG("Disconnecting the Foot controller\n")
             
-            DomeMotor->stop();
+            setDomeMotor(0);
             PS3NavDome->disconnect();
             WaitingforReconnectDome = true;
             return true;
@@ -2524,7 +3705,7 @@ bool criticalFaultDetectDome()
             SHADOW_DEBUG("Too much bad data coming from the PS3 DOME Controller\n")
             SHADOW_DEBUG("Disconnecting the controller and stop motors.\n")
 
-            DomeMotor->stop();
+            setDomeMotor(0);
             PS3NavDome->disconnect();
             WaitingforReconnectDome = true;
             return true;
@@ -2555,7 +3736,7 @@ bool readUSB()
         SHADOW_DEBUG("No foot controller was found\n")
         SHADOW_DEBUG("Shuting down motors, and watching for a new PS3 foot message\n")
 
-        FootMotor->stop();
+        FootMotor.stop();
         isFootMotorStopped = true;
         footDriveSpeed = 0;
         WaitingforReconnect = true;
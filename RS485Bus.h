@@ -0,0 +1,230 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Start of every bus frame
+#define RS485_SOH               0x01
+// Set in the address of frames sent back to the controller by a board
+#define RS485_REPLY_FLAG        0x80
+// Must hold the longest Marcduino command (MARCDUINO_COMMAND_MAX)
+#define RS485_MAX_PAYLOAD       128
+// Frames queued during one loop pass. Sent together in one transmit window
+#define RS485_TX_QUEUE_SIZE     512
+// Milliseconds between bytes before a partial reply is dropped. Bytes are timestamped when
+// loop() reads them, so this must be longer than a normal loop pass
+#define RS485_BYTE_TIMEOUT      50
+
+/**
+  * \class RS485Bus
+  *
+  * \brief Addressed frames on a half-duplex RS-485 multi-drop bus
+  *
+  * Frame layout:
+  *
+  *   SOH(0x01) address(1) length(1) payload(length) checksum(1)
+  *
+  * The checksum is chosen so that address, length, payload and checksum add up to zero
+  * (mod 256). Frames to a board use its address (1..127). Replies from a board use its
+  * address with RS485_REPLY_FLAG set, so the controller never mistakes its own
+  * transmission for a reply if the transceiver echoes it.
+  *
+  * send() only queues the frame. task() is called once per loop pass and writes every
+  * whole frame that fits in the UART transmit buffer with a single write, so commands for
+  * several boards go out back to back in one transmit window and loop() never blocks on
+  * the bus. The UART drives RTS to turn the transceiver around (see RS485_SERIAL_INIT).
+  *
+  * A reply that stops part way is dropped when the next byte arrives more than
+  * RS485_BYTE_TIMEOUT later, so it cannot swallow the start of the following reply.
+*/
+class RS485Bus
+{
+public:
+    typedef void (*ReplyHandler)(uint8_t address, const uint8_t* payload, uint8_t length);
+
+    RS485Bus(Stream& stream) :
+        fStream(stream)
+    {
+    }
+
+    void setReplyHandler(ReplyHandler handler)
+    {
+        fReplyHandler = handler;
+    }
+
+    /** \brief Queue a text command for address. Returns false if it does not fit */
+    bool send(uint8_t address, const char* cmd)
+    {
+        return send(address, (const uint8_t*)cmd, strlen(cmd));
+    }
+
+    bool send(uint8_t address, const uint8_t* payload, size_t length)
+    {
+        if (length > RS485_MAX_PAYLOAD || fQueueLength + length + 4 > sizeof(fQueue))
+        {
+            fDropped++;
+            return false;
+        }
+        uint8_t* frame = &fQueue[fQueueLength];
+        uint8_t sum = address + uint8_t(length);
+        frame[0] = RS485_SOH;
+        frame[1] = address;
+        frame[2] = uint8_t(length);
+        for (size_t i = 0; i < length; i++)
+        {
+            frame[3 + i] = payload[i];
+            sum += payload[i];
+        }
+        frame[3 + length] = uint8_t(-sum);
+        fQueueLength += length + 4;
+        fFramesQueued++;
+        return true;
+    }
+
+    /** \brief Parse replies and send queued frames */
+    void task(uint32_t now)
+    {
+        while (fStream.available())
+        {
+            receive(uint8_t(fStream.read()), now);
+        }
+        if (fQueueLength == 0)
+            return;
+        // Only whole frames so a board never sees half a frame followed by a gap
+        size_t room = fStream.availableForWrite();
+        size_t len = 0;
+        while (len < fQueueLength && len + fQueue[len + 2] + 4 <= room)
+        {
+            len += fQueue[len + 2] + 4;
+        }
+        if (len == 0)
+        {
+            fDeferred++;
+            return;
+        }
+        fStream.write(fQueue, len);
+        fTransmitWindows++;
+        fQueueLength -= len;
+        if (fQueueLength != 0)
+            memmove(fQueue, &fQueue[len], fQueueLength);
+    }
+
+    bool idle() const
+    {
+        return fQueueLength == 0;
+    }
+
+    uint32_t transmitWindows() const
+    {
+        return fTransmitWindows;
+    }
+
+    uint32_t deferred() const
+    {
+        return fDeferred;
+    }
+
+    uint32_t replies() const
+    {
+        return fReplies;
+    }
+
+    uint32_t badReplies() const
+    {
+        return fBadReplies;
+    }
+
+    void printStats()
+    {
+        printf("Frames queued:    %u\n", fFramesQueued);
+        printf("Transmit windows: %u\n", fTransmitWindows);
+        printf("Dropped:          %u\n", fDropped);
+        printf("Deferred:         %u\n", fDeferred);
+        printf("Replies:          %u\n", fReplies);
+        printf("Bad replies:      %u\n", fBadReplies);
+    }
+
+private:
+    enum State
+    {
+        kSOH,
+        kAddress,
+        kLength,
+        kPayload,
+        kChecksum
+    };
+
+    Stream& fStream;
+    ReplyHandler fReplyHandler = nullptr;
+    uint8_t fQueue[RS485_TX_QUEUE_SIZE];
+    size_t fQueueLength = 0;
+
+    State fState = kSOH;
+    uint8_t fAddress = 0;
+    uint8_t fLength = 0;
+    uint8_t fPos = 0;
+    uint8_t fSum = 0;
+    uint32_t fLastByte = 0;
+    uint8_t fPayload[RS485_MAX_PAYLOAD];
+
+    uint32_t fFramesQueued = 0;
+    uint32_t fTransmitWindows = 0;
+    uint32_t fDropped = 0;
+    uint32_t fDeferred = 0;
+    uint32_t fReplies = 0;
+    uint32_t fBadReplies = 0;
+
+    void receive(uint8_t ch, uint32_t now)
+    {
+        if (fState != kSOH && now - fLastByte > RS485_BYTE_TIMEOUT)
+        {
+            fBadReplies++;
+            fState = kSOH;
+        }
+        fLastByte = now;
+        switch (fState)
+        {
+            case kSOH:
+                if (ch == RS485_SOH)
+                    fState = kAddress;
+                break;
+            case kAddress:
+                fAddress = ch;
+                fSum = ch;
+                fState = kLength;
+                break;
+            case kLength:
+                fLength = ch;
+                fSum += ch;
+                fPos = 0;
+                if (ch > RS485_MAX_PAYLOAD)
+                {
+                    fBadReplies++;
+                    fState = kSOH;
+                }
+                else
+                {
+                    fState = (ch != 0) ? kPayload : kChecksum;
+                }
+                break;
+            case kPayload:
+                fPayload[fPos++] = ch;
+                fSum += ch;
+                if (fPos == fLength)
+                    fState = kChecksum;
+                break;
+            case kChecksum:
+                fState = kSOH;
+                if (uint8_t(fSum + ch) != 0)
+                {
+                    fBadReplies++;
+                }
+                else if (fAddress & RS485_REPLY_FLAG)
+                {
+                    fReplies++;
+                    if (fReplyHandler != nullptr)
+                        fReplyHandler(fAddress & ~RS485_REPLY_FLAG, fPayload, fLength);
+                }
+                break;
+        }
+    }
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include "ReelTwo.h"
+#include "MotorPortLock.h"
+
+/**
+  * \class SabertoothTelemetry
+  *
+  * \brief Reads battery voltage, motor current and temperature back from a Sabertooth 2x32
+  *
+  * Uses the packet serial Get command (41). Each request is answered with a Reply packet (73):
+  *
+  *   request: address, 41, getType, checksum, 'M', '1'|'2', checksum
+  *   reply:   address, 73, getType|sign, checksum, value&127, value>>7, 'M', '1'|'2', checksum
+  *
+  * The motor command stream always has priority. task() only sends a request when the
+  * request and its reply both fit in the bus idle time before the next motor command is
+  * due, so polling never delays a drive command. Readings are cached with the time they
+  * were received.
+  *
+  * Battery is reported in tenths of a volt, current in tenths of an amp and temperature
+  * in degrees C. SyRen controllers do not support Get and are not polled.
+*/
+class SabertoothTelemetry
+{
+public:
+    enum Reading
+    {
+        kBattery,
+        kCurrent1,
+        kCurrent2,
+        kTemperature1,
+        kTemperature2,
+        kReadingCount
+    };
+
+    SabertoothTelemetry(uint8_t address, Stream& stream) :
+        fAddress(address),
+        fStream(stream)
+    {
+    }
+
+    void setBaudRate(uint32_t baud)
+    {
+        // 10 bits per byte (start + 8 data + stop)
+        fByteTimeUs = (baud != 0) ? 10000000UL / baud : 1000;
+    }
+
+    void setPollInterval(uint32_t ms)
+    {
+        fPollIntervalMs = ms;
+    }
+
+    /** \brief Poll and parse replies
+      *
+      * \param now current millis()
+      * \param busIdleMs milliseconds until the next motor command is due on the same serial port
+      */
+    void task(uint32_t now, uint32_t busIdleMs)
+    {
+        while (fStream.available())
+        {
+            receive(uint8_t(fStream.read()), now);
+        }
+        if (fOutstanding && now - fRequestTime > replyTimeoutMs())
+        {
+            fOutstanding = false;
+            fTimeouts++;
+        }
+        if (fOutstanding || now - fLastPoll < fPollIntervalMs)
+            return;
+        // Request, reply and one byte of slack must be done before the next motor command
+        uint32_t needUs = (kRequestLength + kReplyLength + 1) * fByteTimeUs;
+        if (uint32_t(busIdleMs) * 1000 < needUs)
+        {
+            fDeferred++;
+            return;
+        }
+        sendRequest(fNextReading);
+        fOutstanding = true;
+        fOutstandingReading = fNextReading;
+        fRequestTime = now;
+        fLastPoll = now;
+        fNextReading = Reading((fNextReading + 1) % kReadingCount);
+    }
+
+    /** \brief Returns true if the reading has been received within maxAgeMs */
+    bool valid(Reading reading, uint32_t now, uint32_t maxAgeMs) const
+    {
+        return fReceived[reading] && now - fTimestamp[reading] <= maxAgeMs;
+    }
+
+    int16_t value(Reading reading) const
+    {
+        return fValue[reading];
+    }
+
+    uint32_t timestamp(Reading reading) const
+    {
+        return fTimestamp[reading];
+    }
+
+    /** \brief Highest current of the two motors, in tenths of an amp */
+    int16_t maxCurrent() const
+    {
+        return max(abs(fValue[kCurrent1]), abs(fValue[kCurrent2]));
+    }
+
+    uint32_t replies() const
+    {
+        return fReplies;
+    }
+
+    uint32_t timeouts() const
+    {
+        return fTimeouts;
+    }
+
+    uint32_t badReplies() const
+    {
+        return fBadReplies;
+    }
+
+    uint32_t deferred() const
+    {
+        return fDeferred;
+    }
+
+    void printStats(uint32_t now)
+    {
+        static const char* sNames[] = {
+            "Battery (0.1V)",
+            "Current M1 (0.1A)",
+            "Current M2 (0.1A)",
+            "Temp M1 (C)",
+            "Temp M2 (C)"
+        };
+        for (unsigned i = 0; i < kReadingCount; i++)
+        {
+            if (fReceived[i])
+                printf("%-18s %6d  %ums ago\n", sNames[i], fValue[i], unsigned(now - fTimestamp[i]));
+            else
+                printf("%-18s    ---\n", sNames[i]);
+        }
+        printf("Replies: %u Timeouts: %u Bad: %u Deferred: %u\n",
+            fReplies, fTimeouts, fBadReplies, fDeferred);
+    }
+
+private:
+    enum
+    {
+        kGetCommand = 41,
+        kReplyCommand = 73,
+        kRequestLength = 7,
+        kReplyLength = 9
+    };
+
+    enum
+    {
+        kGetValue = 0x00,
+        kGetBattery = 0x10,
+        kGetCurrent = 0x20,
+        kGetTemperature = 0x40
+    };
+
+    uint8_t fAddress;
+    Stream& fStream;
+    uint32_t fByteTimeUs = 1042;
+    uint32_t fPollIntervalMs = 100;
+    uint32_t fLastPoll = 0;
+    uint32_t fRequestTime = 0;
+    bool fOutstanding = false;
+    Reading fOutstandingReading = kBattery;
+    Reading fNextReading = kBattery;
+    uint8_t fReply[kReplyLength];
+    uint8_t fReplyPos = 0;
+    bool fReceived[kReadingCount] = {};
+    int16_t fValue[kReadingCount] = {};
+    uint32_t fTimestamp[kReadingCount] = {};
+    uint32_t fReplies = 0;
+    uint32_t fTimeouts = 0;
+    uint32_t fBadReplies = 0;
+    uint32_t fDeferred = 0;
+
+    uint32_t replyTimeoutMs() const
+    {
+        return (kRequestLength + kReplyLength) * fByteTimeUs / 1000 + 10;
+    }
+
+    static uint8_t getType(Reading reading)
+    {
+        switch (reading)
+        {
+            case kBattery:
+                return kGetBattery;
+            case kCurrent1:
+            case kCurrent2:
+                return kGetCurrent;
+            case kTemperature1:
+            case kTemperature2:
+                return kGetTemperature;
+            default:
+                return kGetValue;
+        }
+    }
+
+    static char motorNumber(Reading reading)
+    {
+        return (reading == kCurrent2 || reading == kTemperature2) ? '2' : '1';
+    }
+
+    void sendRequest(Reading reading)
+    {
+        uint8_t packet[kRequestLength];
+        packet[0] = fAddress;
+        packet[1] = kGetCommand;
+        packet[2] = getType(reading);
+        packet[3] = (packet[0] + packet[1] + packet[2]) & 0x7F;
+        packet[4] = 'M';
+        packet[5] = motorNumber(reading);
+        packet[6] = (packet[4] + packet[5]) & 0x7F;
+        MotorPortLock lock;
+        fStream.write(packet, sizeof(packet));
+        fReplyPos = 0;
+    }
+
+    void receive(uint8_t ch, uint32_t now)
+    {
+        // Resynchronize on the address byte
+        if (fReplyPos == 0 && ch != fAddress)
+            return;
+        fReply[fReplyPos++] = ch;
+        if (fReplyPos == 2 && ch != kReplyCommand)
+        {
+            fReplyPos = 0;
+            return;
+        }
+        if (fReplyPos < kReplyLength)
+            return;
+        fReplyPos = 0;
+
+        uint8_t* r = fReply;
+        if (((r[0] + r[1] + r[2]) & 0x7F) != r[3] ||
+            ((r[4] + r[5] + r[6] + r[7]) & 0x7F) != r[8] ||
+            r[6] != 'M')
+        {
+            fBadReplies++;
+            return;
+        }
+        uint8_t type = r[2] & 0xF0;
+        int16_t value = r[4] | (r[5] << 7);
+        if (r[2] & 0x01)
+            value = -value;
+        Reading reading;
+        if (type == kGetBattery)
+            reading = kBattery;
+        else if (type == kGetCurrent)
+            reading = (r[7] == '2') ? kCurrent2 : kCurrent1;
+        else if (type == kGetTemperature)
+            reading = (r[7] == '2') ? kTemperature2 : kTemperature1;
+        else
+        {
+            fBadReplies++;
+            return;
+        }
+        fValue[reading] = value;
+        fTimestamp[reading] = now;
+        fReceived[reading] = true;
+        fReplies++;
+        if (fOutstanding && reading == fOutstandingReading)
+            fOutstanding = false;
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "HostProtocol.h"
+
+// Every this many frames is a keyframe with all fields so the host can resync after a lost frame
+#define TELEMETRY_KEYFRAME_INTERVAL     50
+#define TELEMETRY_MAX_RATE              100
+
+/**
+  * \class TelemetryStream
+  *
+  * \brief Periodic delta-encoded status frames for a live dashboard
+  *
+  * Each frame is sent as an unsolicited host protocol frame (see HostProtocol.h) with
+  * the frame counter as sequence number. Payload:
+  *
+  *   u8 flags (bit 0 = keyframe), varint changed-field mask, zigzag varint per set bit
+  *
+  * Values are listed in field order. In a keyframe every bit is set and the values are
+  * absolute, otherwise each value is the change since the previous frame and unchanged
+  * fields are left out. A host that sees a gap in the sequence numbers ignores frames
+  * until the next keyframe.
+*/
+template <unsigned kFieldCount>
+class TelemetryStream
+{
+public:
+    static_assert(kFieldCount <= 32, "changed-field mask is 32 bits");
+
+    /** \brief Frames per second, 0 stops the stream */
+    void setRate(uint32_t hz)
+    {
+        fRate = min(hz, uint32_t(TELEMETRY_MAX_RATE));
+        fIntervalMs = (fRate != 0) ? 1000 / fRate : 0;
+        fNextFrame = millis();
+        fSinceKeyframe = TELEMETRY_KEYFRAME_INTERVAL;
+    }
+
+    uint32_t rate() const
+    {
+        return fRate;
+    }
+
+    /** \brief True when a frame should be sent now. The caller then sets the fields and calls send() */
+    bool due(uint32_t now)
+    {
+        if (fIntervalMs == 0 || int32_t(now - fNextFrame) < 0)
+            return false;
+        fNextFrame += fIntervalMs;
+        // Fell more than a frame behind: skip ahead rather than send a burst
+        if (int32_t(now - fNextFrame) >= 0)
+            fNextFrame = now + fIntervalMs;
+        return true;
+    }
+
+    void set(unsigned field, int32_t value)
+    {
+        fValue[field] = value;
+    }
+
+    void send(Print& out, uint8_t type)
+    {
+        uint8_t buffer[1 + 5 + kFieldCount * 5];
+        HostPayloadWriter payload(buffer, sizeof(buffer));
+        bool keyframe = (fSinceKeyframe >= TELEMETRY_KEYFRAME_INTERVAL);
+        uint32_t mask = 0;
+        for (unsigned i = 0; i < kFieldCount; i++)
+        {
+            if (keyframe || fValue[i] != fPrevious[i])
+                mask |= 1UL << i;
+        }
+        payload.u8(keyframe ? 0x01 : 0x00);
+        payload.varint(mask);
+        for (unsigned i = 0; i < kFieldCount; i++)
+        {
+            if (mask & (1UL << i))
+            {
+                payload.svarint(keyframe ? fValue[i] : int32_t(uint32_t(fValue[i]) - uint32_t(fPrevious[i])));
+                fPrevious[i] = fValue[i];
+            }
+        }
+        HostProtocol::send(out, type, fSeq++, payload.data(), payload.length());
+        fSinceKeyframe = (keyframe) ? 1 : fSinceKeyframe + 1;
+        fFrames++;
+        fBytes += payload.length() + 7;
+    }
+
+    void printStats()
+    {
+        printf("Rate: %uHz Frames: %u Avg frame: %u bytes\n", fRate, fFrames,
+            (fFrames != 0) ? unsigned(fBytes / fFrames) : 0);
+    }
+
+private:
+    uint32_t fRate = 0;
+    uint32_t fIntervalMs = 0;
+    uint32_t fNextFrame = 0;
+    unsigned fSinceKeyframe = TELEMETRY_KEYFRAME_INTERVAL;
+    uint8_t fSeq = 0;
+    uint32_t fFrames = 0;
+    uint64_t fBytes = 0;
+    int32_t fValue[kFieldCount] = {};
+    int32_t fPrevious[kFieldCount] = {};
+};
@@ -42,8 +42,22 @@
 #define SOUND_SERIAL            Serial2
 
 #define MD_SERIAL_INIT(baud)         MD_SERIAL.begin(baud, SERIAL_8N1, MD_SERIAL_RX, MD_SERIAL_TX)
+#ifdef USE_RS485_MARCDUINO_BUS
+// RS-485 bus on the MD_SERIAL port. The UART drives RS485_RTS_PIN (transceiver DE/RE) while transmitting.
+// Needs the IDF UART driver underneath HardwareSerial (esp32 board package 2.x)
+#include <driver/uart.h>
+#define RS485_SERIAL                 MD_SERIAL
+#define RS485_UART_NUM               UART_NUM_1
+#define RS485_SERIAL_INIT(baud)      { RS485_SERIAL.begin(baud, SERIAL_8N1, MD_SERIAL_RX, MD_SERIAL_TX); \
+                                       RS485_SERIAL.setPins(MD_SERIAL_RX, MD_SERIAL_TX, -1, RS485_RTS_PIN); \
+                                       uart_set_mode(RS485_UART_NUM, UART_MODE_RS485_HALF_DUPLEX); }
+#endif
 #define BODY_MD_SERIAL_INIT(baud)    BODY_MD_SERIAL.begin(baud, SERIAL_8N1, BODY_MD_SERIAL_RX, BODY_MD_SERIAL_TX)
+#ifdef USE_SABERTOOTH_TELEMETRY
+#define MOTOR_SERIAL_INIT(baud)      MOTOR_SERIAL.begin(baud, SWSERIAL_8N1, MOTOR_SERIAL_RX, MOTOR_SERIAL_TX, false)
+#else
 #define MOTOR_SERIAL_INIT(baud)      MOTOR_SERIAL.begin(baud, SWSERIAL_8N1, -1, MOTOR_SERIAL_TX, false)
+#endif
 // #define SOUND_SERIAL_INIT(baud)      { SOUND_SERIAL.begin(baud, SWSERIAL_8N1, SOUND_SERIAL_RX, SOUND_SERIAL_TX, false); delay(1500); }
 #define SOUND_SERIAL_INIT(baud)      SOUND_SERIAL.begin(baud, SERIAL_8N1, SOUND_SERIAL_RX, SOUND_SERIAL_TX)
 
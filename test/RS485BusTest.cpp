@@ -0,0 +1,292 @@
+// Host test for RS485Bus over a loopback bus with two emulated Marcduino boards
+//
+//   make -C test
+
+#include "TestMain.h"
+#include "RS485Bus.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// A board decodes the frames for its address and answers each one with "OK"
+struct FakeBoard
+{
+    uint8_t fAddress;
+    std::vector<std::string> fCommands;
+};
+
+// Every write() is one transmit window. Frames are checked and handed to the boards,
+// whose replies are queued for the controller to read
+class LoopbackBus : public Stream
+{
+public:
+    std::vector<FakeBoard*> fBoards;
+    std::deque<uint8_t> fReceived;
+    std::vector<size_t> fWindows;
+    size_t fRoom = 128;
+    bool fEcho = false;
+    unsigned fBadFrames = 0;
+
+    size_t write(uint8_t ch) override
+    {
+        return write(&ch, 1);
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override
+    {
+        fWindows.push_back(size);
+        if (fEcho)
+            fReceived.insert(fReceived.end(), buffer, buffer + size);
+        size_t i = 0;
+        while (i + 4 <= size)
+        {
+            uint8_t address = buffer[i + 1];
+            uint8_t length = buffer[i + 2];
+            uint8_t sum = 0;
+            for (size_t k = i + 1; k < i + 4 + length && k < size; k++)
+                sum += buffer[k];
+            if (buffer[i] != RS485_SOH || i + 4 + length > size || sum != 0)
+            {
+                fBadFrames++;
+                return size;
+            }
+            for (FakeBoard* board : fBoards)
+            {
+                if (board->fAddress == address)
+                {
+                    board->fCommands.push_back(std::string((const char*)&buffer[i + 3], length));
+                    reply(address, "OK");
+                }
+            }
+            i += 4 + length;
+        }
+        if (i != size)
+            fBadFrames++;
+        return size;
+    }
+
+    int availableForWrite() override
+    {
+        return int(fRoom);
+    }
+
+    int available() override
+    {
+        return int(fReceived.size());
+    }
+
+    int read() override
+    {
+        int ch = fReceived.front();
+        fReceived.pop_front();
+        return ch;
+    }
+
+    int peek() override
+    {
+        return fReceived.front();
+    }
+
+    void reply(uint8_t address, const char* text, bool corrupt = false)
+    {
+        uint8_t length = uint8_t(strlen(text));
+        uint8_t sum = uint8_t(address | RS485_REPLY_FLAG) + length;
+        fReceived.push_back(RS485_SOH);
+        fReceived.push_back(address | RS485_REPLY_FLAG);
+        fReceived.push_back(length);
+        for (uint8_t i = 0; i < length; i++)
+        {
+            fReceived.push_back(text[i]);
+            sum += uint8_t(text[i]);
+        }
+        fReceived.push_back(uint8_t(-sum) ^ (corrupt ? 0x01 : 0x00));
+    }
+};
+
+static unsigned sReplies[3];
+static std::string sLastReply;
+
+static void onReply(uint8_t address, const uint8_t* payload, uint8_t length)
+{
+    if (address < 3)
+        sReplies[address]++;
+    sLastReply.assign((const char*)payload, length);
+}
+
+static void resetReplies()
+{
+    memset(sReplies, 0, sizeof(sReplies));
+    sLastReply.clear();
+}
+
+static void testFraming()
+{
+    LoopbackBus bus;
+    FakeBoard dome = { 1 };
+    bus.fBoards = { &dome };
+    RS485Bus rs(bus);
+
+    CHECK(rs.send(1, ":OP01"));
+    rs.task(0);
+    const uint8_t expected[] = { RS485_SOH, 1, 5, ':', 'O', 'P', '0', '1',
+        uint8_t(-(1 + 5 + ':' + 'O' + 'P' + '0' + '1')) };
+    CHECK(bus.fWindows.size() == 1 && bus.fWindows[0] == sizeof(expected));
+    CHECK(bus.fBadFrames == 0);
+    CHECK(dome.fCommands.size() == 1 && dome.fCommands[0] == ":OP01");
+
+    // The longest Marcduino command (MARCDUINO_COMMAND_MAX - 1 characters) fits in one frame
+    char longest[104];
+    memset(longest, 'y', sizeof(longest) - 1);
+    longest[sizeof(longest) - 1] = '\0';
+    bus.fRoom = 256;
+    CHECK(rs.send(1, longest));
+    rs.task(1);
+    CHECK(bus.fBadFrames == 0);
+    CHECK(dome.fCommands.size() == 2 && dome.fCommands[1] == longest);
+
+    // Payloads longer than RS485_MAX_PAYLOAD are refused
+    char tooLong[RS485_MAX_PAYLOAD + 2];
+    memset(tooLong, 'x', sizeof(tooLong) - 1);
+    tooLong[sizeof(tooLong) - 1] = '\0';
+    CHECK(!rs.send(1, tooLong));
+}
+
+static void testBatching()
+{
+    LoopbackBus bus;
+    FakeBoard dome = { 1 };
+    FakeBoard body = { 2 };
+    bus.fBoards = { &dome, &body };
+    RS485Bus rs(bus);
+    rs.setReplyHandler(onReply);
+    resetReplies();
+
+    rs.send(1, ":OP01");
+    rs.send(2, ":CL00");
+    rs.send(1, "$12");
+    rs.task(0);
+    // All three frames in one transmit window
+    CHECK(bus.fWindows.size() == 1 && rs.transmitWindows() == 1);
+    CHECK(dome.fCommands.size() == 2 && dome.fCommands[1] == "$12");
+    CHECK(body.fCommands.size() == 1 && body.fCommands[0] == ":CL00");
+    CHECK(rs.idle());
+
+    // Replies are parsed on the next pass and routed by address
+    rs.task(1);
+    CHECK(sReplies[1] == 2 && sReplies[2] == 1);
+    CHECK(sLastReply == "OK");
+    CHECK(rs.replies() == 3 && rs.badReplies() == 0);
+}
+
+static void testPartialTransmit()
+{
+    LoopbackBus bus;
+    FakeBoard dome = { 1 };
+    FakeBoard body = { 2 };
+    bus.fBoards = { &dome, &body };
+    RS485Bus rs(bus);
+
+    // Room for one 8-byte frame but not two
+    bus.fRoom = 12;
+    rs.send(1, "@1T1");
+    rs.send(2, "@2T2");
+    rs.task(0);
+    CHECK(bus.fWindows.size() == 1 && bus.fWindows[0] == 8);
+    CHECK(!rs.idle());
+    rs.task(1);
+    CHECK(bus.fWindows.size() == 2 && rs.idle());
+    CHECK(bus.fBadFrames == 0);
+
+    // Not even one whole frame fits: nothing is written
+    bus.fRoom = 4;
+    rs.send(1, "@1T1");
+    rs.task(2);
+    CHECK(bus.fWindows.size() == 2 && rs.deferred() == 1);
+    bus.fRoom = 128;
+    rs.task(3);
+    CHECK(bus.fWindows.size() == 3 && rs.idle());
+    CHECK(dome.fCommands.size() == 2 && body.fCommands.size() == 1);
+}
+
+static void testReplyFlag()
+{
+    LoopbackBus bus;
+    RS485Bus rs(bus);
+    rs.setReplyHandler(onReply);
+    resetReplies();
+
+    // The transceiver echoes our own frames, which must not be taken as replies
+    bus.fEcho = true;
+    rs.send(1, ":OP01");
+    rs.send(2, ":CL00");
+    rs.task(0);
+    rs.task(1);
+    CHECK(rs.replies() == 0 && rs.badReplies() == 0);
+    CHECK(sReplies[1] == 0 && sReplies[2] == 0);
+
+    bus.reply(2, "V1.8");
+    rs.task(2);
+    CHECK(sReplies[2] == 1 && sLastReply == "V1.8");
+}
+
+static void testBadChecksum()
+{
+    LoopbackBus bus;
+    RS485Bus rs(bus);
+    rs.setReplyHandler(onReply);
+    resetReplies();
+
+    bus.reply(1, "OK", true);
+    rs.task(0);
+    CHECK(rs.badReplies() == 1 && rs.replies() == 0 && sReplies[1] == 0);
+
+    // The parser is back in sync for the next reply
+    bus.reply(1, "OK");
+    rs.task(1);
+    CHECK(rs.replies() == 1 && sReplies[1] == 1);
+
+    // Oversized length byte
+    bus.fReceived = { RS485_SOH, 0x81, RS485_MAX_PAYLOAD + 1 };
+    rs.task(2);
+    CHECK(rs.badReplies() == 2);
+}
+
+static void testByteTimeout()
+{
+    LoopbackBus bus;
+    RS485Bus rs(bus);
+    rs.setReplyHandler(onReply);
+    resetReplies();
+
+    // A reply cut off after its length byte
+    bus.fReceived = { RS485_SOH, 0x81, 2 };
+    rs.task(100);
+    // The next reply arrives long after: the partial one is dropped rather than
+    // swallowing the start of this one
+    bus.reply(1, "OK");
+    rs.task(100 + RS485_BYTE_TIMEOUT + 1);
+    CHECK(rs.badReplies() == 1);
+    CHECK(rs.replies() == 1 && sReplies[1] == 1);
+
+    // A reply split across two loop passes within the timeout is still parsed
+    bus.reply(2, "OK");
+    std::deque<uint8_t> rest(bus.fReceived.begin() + 3, bus.fReceived.end());
+    bus.fReceived.resize(3);
+    rs.task(200);
+    bus.fReceived = rest;
+    rs.task(200 + RS485_BYTE_TIMEOUT);
+    CHECK(rs.replies() == 2 && sReplies[2] == 1);
+    CHECK(rs.badReplies() == 1);
+}
+
+int main()
+{
+    testFraming();
+    testBatching();
+    testPartialTransmit();
+    testReplyFlag();
+    testBadChecksum();
+    testByteTimeout();
+    return testResult();
+}
@@ -0,0 +1,175 @@
+// Host test for SabertoothTelemetry against a simulated Sabertooth 2x32
+//
+//   make -C test
+
+#include "TestMain.h"
+#include "SabertoothTelemetry.h"
+
+#include <deque>
+#include <vector>
+
+#define ADDRESS 128
+
+// Records what the firmware sends and plays back replies queued by the test
+class FakeSabertooth : public Stream
+{
+public:
+    std::vector<uint8_t> fSent;
+    std::deque<uint8_t> fReplies;
+
+    size_t write(uint8_t ch) override
+    {
+        fSent.push_back(ch);
+        return 1;
+    }
+
+    int available() override
+    {
+        return int(fReplies.size());
+    }
+
+    int read() override
+    {
+        int ch = fReplies.front();
+        fReplies.pop_front();
+        return ch;
+    }
+
+    int peek() override
+    {
+        return fReplies.front();
+    }
+
+    void reply(uint8_t type, uint16_t value, char motor, bool negative = false, bool corrupt = false)
+    {
+        uint8_t r[9];
+        r[0] = ADDRESS;
+        r[1] = 73;
+        r[2] = type | (negative ? 0x01 : 0x00);
+        r[3] = (r[0] + r[1] + r[2]) & 0x7F;
+        r[4] = value & 0x7F;
+        r[5] = value >> 7;
+        r[6] = 'M';
+        r[7] = motor;
+        r[8] = (r[4] + r[5] + r[6] + r[7]) & 0x7F;
+        if (corrupt)
+            r[8] ^= 0x01;
+        fReplies.insert(fReplies.end(), r, r + sizeof(r));
+    }
+};
+
+static void testGetRequest()
+{
+    FakeSabertooth st;
+    SabertoothTelemetry telemetry(ADDRESS, st);
+    telemetry.setBaudRate(9600);
+    telemetry.task(1000, 100);
+
+    const uint8_t expected[] = { ADDRESS, 41, 0x10, (ADDRESS + 41 + 0x10) & 0x7F, 'M', '1', ('M' + '1') & 0x7F };
+    CHECK(st.fSent.size() == sizeof(expected));
+    CHECK(memcmp(st.fSent.data(), expected, sizeof(expected)) == 0);
+}
+
+static void testReplyAndSign()
+{
+    FakeSabertooth st;
+    SabertoothTelemetry telemetry(ADDRESS, st);
+    telemetry.setBaudRate(9600);
+    telemetry.setPollInterval(10);
+
+    // Battery 24.3V
+    telemetry.task(1000, 100);
+    st.reply(0x10, 243, '1');
+    telemetry.task(1005, 100);
+    CHECK(telemetry.valid(SabertoothTelemetry::kBattery, 1005, 100));
+    CHECK(telemetry.value(SabertoothTelemetry::kBattery) == 243);
+
+    // Motor 1 current -5.5A, sign carried in bit 0 of the type byte
+    telemetry.task(1010, 100);
+    CHECK(st.fSent.size() == 14 && st.fSent[9] == 0x20 && st.fSent[12] == '1');
+    st.reply(0x20, 55, '1', true);
+    telemetry.task(1015, 100);
+    CHECK(telemetry.value(SabertoothTelemetry::kCurrent1) == -55);
+
+    // Motor 2 current 130.0A needs both value bytes
+    telemetry.task(1020, 100);
+    st.reply(0x20, 1300, '2');
+    telemetry.task(1025, 100);
+    CHECK(telemetry.value(SabertoothTelemetry::kCurrent2) == 1300);
+    CHECK(telemetry.maxCurrent() == 1300);
+    CHECK(telemetry.replies() == 3);
+    CHECK(!telemetry.valid(SabertoothTelemetry::kTemperature1, 1025, 100));
+}
+
+static void testBadChecksum()
+{
+    FakeSabertooth st;
+    SabertoothTelemetry telemetry(ADDRESS, st);
+    telemetry.setBaudRate(9600);
+
+    telemetry.task(1000, 100);
+    st.reply(0x10, 243, '1', false, true);
+    telemetry.task(1005, 100);
+    CHECK(telemetry.badReplies() == 1);
+    CHECK(telemetry.replies() == 0);
+    CHECK(!telemetry.valid(SabertoothTelemetry::kBattery, 1005, 100));
+
+    // Noise before a good reply is skipped
+    st.fReplies.push_back(0x55);
+    st.reply(0x10, 240, '1');
+    telemetry.task(1010, 100);
+    CHECK(telemetry.value(SabertoothTelemetry::kBattery) == 240);
+}
+
+static void testTimeout()
+{
+    FakeSabertooth st;
+    SabertoothTelemetry telemetry(ADDRESS, st);
+    telemetry.setBaudRate(9600);
+    telemetry.setPollInterval(10);
+
+    telemetry.task(1000, 100);
+    CHECK(st.fSent.size() == 7);
+    // Still waiting for the reply, no new request
+    telemetry.task(1020, 100);
+    CHECK(st.fSent.size() == 7 && telemetry.timeouts() == 0);
+    // 16 bytes at 9600 baud plus 10ms slack
+    telemetry.task(1030, 100);
+    CHECK(telemetry.timeouts() == 1);
+    // Moves on to the next reading
+    CHECK(st.fSent.size() == 14 && st.fSent[9] == 0x20);
+}
+
+static void testDeferral()
+{
+    FakeSabertooth st;
+    SabertoothTelemetry telemetry(ADDRESS, st);
+    telemetry.setBaudRate(9600);
+
+    // Request and reply need about 18ms at 9600 baud
+    telemetry.task(1000, 10);
+    CHECK(st.fSent.empty());
+    CHECK(telemetry.deferred() == 1);
+    telemetry.task(1001, 17);
+    CHECK(st.fSent.empty());
+    CHECK(telemetry.deferred() == 2);
+    telemetry.task(1002, 19);
+    CHECK(st.fSent.size() == 7);
+
+    // Faster bus needs less idle time
+    FakeSabertooth fast;
+    SabertoothTelemetry fastTelemetry(ADDRESS, fast);
+    fastTelemetry.setBaudRate(115200);
+    fastTelemetry.task(1000, 2);
+    CHECK(fast.fSent.size() == 7);
+}
+
+int main()
+{
+    testGetRequest();
+    testReplyAndSign();
+    testBadChecksum();
+    testTimeout();
+    testDeferral();
+    return testResult();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Minimal check macro for the host tests. Each test program returns non-zero if any check failed
+
+#include <stdio.h>
+
+static unsigned sChecks;
+static unsigned sFailures;
+
+#define CHECK(expr) \
+    do { \
+        sChecks++; \
+        if (!(expr)) { \
+            sFailures++; \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+        } \
+    } while (0)
+
+static int testResult()
+{
+    printf("%u checks, %u failed\n", sChecks, sFailures);
+    return (sFailures != 0) ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// Just enough of the Arduino and FreeRTOS API to build the sketch's protocol classes on the host
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t millis();
+
+template <typename T> const T& min(const T& a, const T& b) { return (b < a) ? b : a; }
+template <typename T> const T& max(const T& a, const T& b) { return (a < b) ? b : a; }
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t ch) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size)
+    {
+        size_t n = 0;
+        while (n < size && write(buffer[n]))
+            n++;
+        return n;
+    }
+    virtual int availableForWrite() { return 0; }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+typedef int BaseType_t;
+typedef void* SemaphoreHandle_t;
+#define portMAX_DELAY 0xffffffff
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { static int sMutex; return &sMutex; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, uint32_t) { return 1; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return 1; }
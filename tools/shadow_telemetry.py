@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""Decode the Penumbra Shadow MD telemetry stream.
+
+Starts the stream on the console serial port, then prints one line (or CSV row) per
+frame. Console text sent by the firmware between frames is skipped.
+
+    pip install pyserial
+    tools/shadow_telemetry.py /dev/ttyUSB0 --rate 50
+    tools/shadow_telemetry.py /dev/ttyUSB0 --csv > run.csv
+
+Frame format is described in HostProtocol.h and TelemetryStream.h. FIELDS must match
+enum TelemetryField in PenumbraShadowMD.ino.
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = 0xA5
+MAX_PAYLOAD = 1088
+HOST_STREAM = 0x09
+HOST_TELEMETRY = 0x40
+
+FIELDS = [
+    "time",
+    "foot_speed",
+    "foot_turn",
+    "dome_speed",
+    "dome_pwm",
+    "dome_status",
+    "dome_target",
+    "flags",
+    "panels_waiting",
+    "panels_open",
+    "sound",
+    "sound_count",
+    "loop_iterations",
+    "loop_overruns",
+    "loop_max_pass_us",
+    "watchdog_trips",
+]
+
+FLAGS = [
+    "foot",
+    "dome",
+    "foot_stopped",
+    "dome_stopped",
+    "derated",
+    "idle",
+    "auto_dome",
+    "overspeed",
+    "random_sound",
+]
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE"""
+    for ch in data:
+        crc ^= ch << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def frame(msg_type, seq, payload=b""):
+    body = struct.pack("<BBH", msg_type, seq, len(payload)) + payload
+    return bytes([SYNC]) + body + struct.pack("<H", crc16(body))
+
+
+class FrameParser:
+    """Pulls valid frames out of a byte stream that also carries console text."""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.errors = 0
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            start = self.buf.find(SYNC)
+            if start < 0:
+                self.buf.clear()
+                return
+            del self.buf[:start]
+            if len(self.buf) < 5:
+                return
+            msg_type, seq, length = struct.unpack_from("<BBH", self.buf, 1)
+            if length > MAX_PAYLOAD:
+                del self.buf[0]
+                continue
+            if len(self.buf) < 7 + length:
+                return
+            body = bytes(self.buf[1:5 + length])
+            (crc,) = struct.unpack_from("<H", self.buf, 5 + length)
+            if crc != crc16(body):
+                # Not a frame, or a damaged one. Resync on the next sync byte
+                self.errors += 1
+                del self.buf[0]
+                continue
+            del self.buf[:7 + length]
+            yield msg_type, seq, body[4:]
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        ch = data[pos]
+        pos += 1
+        value |= (ch & 0x7F) << shift
+        if not ch & 0x80:
+            return value, pos
+        shift += 7
+
+
+def zigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+class TelemetryDecoder:
+    """Applies delta frames to the last keyframe. Waits for a keyframe after a lost frame."""
+
+    def __init__(self):
+        self.values = None
+        self.seq = None
+        self.lost = 0
+
+    def decode(self, seq, payload):
+        if self.seq is not None and seq != (self.seq + 1) & 0xFF:
+            self.lost += 1
+            self.values = None
+        self.seq = seq
+        keyframe = payload[0] & 0x01
+        mask, pos = read_varint(payload, 1)
+        if keyframe:
+            self.values = [0] * len(FIELDS)
+        elif self.values is None:
+            return None
+        for i in range(32):
+            if mask & (1 << i):
+                value, pos = read_varint(payload, pos)
+                if i < len(self.values):
+                    if keyframe:
+                        self.values[i] = zigzag(value)
+                    else:
+                        self.values[i] = (self.values[i] + zigzag(value)) & 0xFFFFFFFF
+                        if self.values[i] >= 0x80000000:
+                            self.values[i] -= 0x100000000
+        return dict(zip(FIELDS, self.values))
+
+
+def format_row(values):
+    flags = values["flags"]
+    names = [name for bit, name in enumerate(FLAGS) if flags & (1 << bit)]
+    fields = ["%s=%d" % (name, values[name]) for name in FIELDS if name != "flags"]
+    return " ".join(fields) + " flags=" + ",".join(names)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", help="serial port, or - to read a capture from stdin")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--rate", type=int, default=50, help="frames per second (1-100)")
+    parser.add_argument("--csv", action="store_true", help="print CSV instead of key=value lines")
+    args = parser.parse_args()
+
+    if args.port == "-":
+        port = None
+        source = sys.stdin.buffer
+    else:
+        import serial
+        port = serial.Serial(args.port, args.baud, timeout=0.1)
+        port.write(frame(HOST_STREAM, 0, bytes([args.rate])))
+        source = port
+
+    frames = FrameParser()
+    telemetry = TelemetryDecoder()
+    if args.csv:
+        print(",".join(FIELDS))
+    try:
+        while True:
+            data = source.read(256)
+            if not data:
+                if port is None:
+                    break
+                continue
+            for msg_type, seq, payload in frames.feed(data):
+                if msg_type != HOST_TELEMETRY:
+                    continue
+                values = telemetry.decode(seq, payload)
+                if values is None:
+                    continue
+                if args.csv:
+                    print(",".join(str(values[name]) for name in FIELDS))
+                else:
+                    print(format_row(values))
+                sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if port is not None:
+            port.write(frame(HOST_STREAM, 0, bytes([0])))
+            port.close()
+    sys.stderr.write("lost frames: %d bad frames: %d\n" % (telemetry.lost, frames.errors))
+
+
+if __name__ == "__main__":
+    main()